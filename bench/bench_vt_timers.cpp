@@ -0,0 +1,85 @@
+// Copyright (c) 2019-2020 VORtech b.v.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Measures the overhead of a tic/toc pair. Built twice: vt_timers_bench calls
+// the C API of the (shared) vt_timers library, vt_timers_bench_inline uses the
+// inline functions of timers_inline.hpp with the static vt_timers_inline library.
+
+#include <vt/timers.hpp>
+#include <vt/timers.h>
+#ifdef VT_TIMERS_BENCH_INLINE
+#include <vt/timers_inline.hpp>
+#endif
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+
+static vtErrorCode tic(const char* name)
+{
+#ifdef VT_TIMERS_BENCH_INLINE
+    return vt::timer_tic(name);
+#else
+    return vt_timer_tic(name);
+#endif
+}
+
+static vtErrorCode toc(const char* name)
+{
+#ifdef VT_TIMERS_BENCH_INLINE
+    return vt::timer_toc(name);
+#else
+    return vt_timer_toc(name);
+#endif
+}
+
+
+int main(int argc, char** argv)
+{
+    using namespace std::chrono;
+
+    const long nr_iterations = argc > 1 ? std::atol(argv[1]) : 1000000L;
+
+    tic("benchmark");
+
+    auto t0 = high_resolution_clock::now();
+    for (long i = 0; i < nr_iterations; ++i)
+    {
+        tic("outer");
+            tic("inner");
+            toc("inner");
+        toc("outer");
+    }
+    auto t1 = high_resolution_clock::now();
+
+    toc("benchmark");
+
+    const double ns_per_pair = duration<double, std::nano>(t1 - t0).count() / (2.0 * static_cast<double>(nr_iterations));
+#ifdef VT_TIMERS_BENCH_INLINE
+    std::cout << "inline fast path: ";
+#else
+    std::cout << "library C API:    ";
+#endif
+    std::cout << ns_per_pair << " ns per tic/toc pair (" << nr_iterations << " iterations)\n";
+
+    vt_timers_reset();
+    return 0;
+}
@@ -0,0 +1,61 @@
+// Copyright (c) 2019-2020 VORtech b.v.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef VT_CLOCK_HPP
+#define VT_CLOCK_HPP
+
+#include <vt/timers.h>
+
+#include <chrono>
+
+
+namespace vt {
+
+#ifdef VT_TIMERS_VIRTUAL_CLOCK
+
+// Clock that only advances when told to, for deterministic tests and benchmark
+// harnesses (vt_timers_virtual_clock library). Each thread has its own virtual
+// time, which starts at 0.
+class VirtualClock
+{
+public:
+    typedef std::chrono::nanoseconds duration;
+    typedef duration::rep rep;
+    typedef duration::period period;
+    typedef std::chrono::time_point<VirtualClock> time_point;
+    static const bool is_steady = true;
+
+    VT_TIMERS_ATTR static time_point now();
+    VT_TIMERS_ATTR static void advance(const duration elapsed);
+};
+
+// The clock that is read by Timer::start and Timer::stop, chosen at compile time.
+typedef VirtualClock TimerClock;
+
+#else
+
+// The clock that is read by Timer::start and Timer::stop, chosen at compile time.
+typedef std::chrono::high_resolution_clock TimerClock;
+
+#endif
+
+}  // namespace vt
+
+#endif  // VT_CLOCK_HPP
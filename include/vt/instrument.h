@@ -0,0 +1,29 @@
+#ifndef VT_INSTRUMENT_H
+#define VT_INSTRUMENT_H
+
+#include <vt/timers.h>
+
+/* Automatic function timers for code compiled with -finstrument-functions, provided
+ * by the vt_timers_instrument library. Each instrumented function gets a timer, keyed
+ * by its address; function names are looked up when the report is made, or when
+ * a function is first called if filters are set (see below).
+ *
+ * The filters can also be set with the environment variables VT_INSTRUMENT_INCLUDE,
+ * VT_INSTRUMENT_EXCLUDE and VT_INSTRUMENT_MIN_DURATION. The function main is never
+ * timed, since reports are usually made before it returns. */
+
+/* Only time functions whose (demangled) name contains one of the comma separated
+ * patterns in include (all functions if include is empty or NULL), and none of the
+ * patterns in exclude.
+ *
+ * To match the filters, the name of each function is looked up (dladdr) and
+ * demangled in the hook of its first call, which therefore takes longer; other
+ * threads are not held up by it, and later calls are not affected. Without
+ * filters, names are only looked up when the report is made. */
+VT_C_API vtErrorCode VT_C_CALLCONV vt_instrument_set_filter(const char* include, const char* exclude);
+
+/* Stop timing functions that take less than the given number of seconds per call on
+ * average, once they have been called often enough to tell (0: time all functions). */
+VT_C_API vtErrorCode VT_C_CALLCONV vt_instrument_set_min_duration(const double seconds);
+
+#endif  /* VT_INSTRUMENT_H */
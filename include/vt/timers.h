@@ -2,6 +2,7 @@
 #define VT_TIMERS_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #ifndef VT_TIMERS_ATTR
 #define VT_TIMERS_ATTR
@@ -28,6 +29,42 @@ typedef enum vtErrorCodes {
     vtERROR = 2
 } vtErrorCode;
 
+typedef enum vtRecursionModes {
+    vtRECURSION_NESTED = 0,     /* a label may be nested below itself, but not re-entered while running */
+    vtRECURSION_COLLAPSED = 1   /* re-entering a running label only increases its recursion depth */
+} vtRecursionMode;
+
+/* A single timer call that took longer than the budget of its timer. */
+typedef struct vtTimerOutlier {
+    double timestamp;          /* end of the call, in seconds since the clock's epoch */
+    double duration;           /* wall time of the call, in seconds */
+    double budget;             /* budget of the timer, in seconds */
+    unsigned long long thread; /* hash of the id of the thread that made the call */
+    char path[256];            /* label path of the timer, e.g. "solve/assemble" (truncated if too long) */
+} vtTimerOutlier;
+
+typedef void (VT_C_CALLCONV *vtTimerOutlierCallback)(const vtTimerOutlier* outlier, void* user_data);
+
+/* A timer in the collected timings, as seen by the query functions below. Each
+ * thread (or thread role) has a root node with depth 0, whose label is the name
+ * of the thread: its role, "Main thread" for the calling thread, or its id. The strings are stored by the library and
+ * stay valid until the next reset. */
+typedef struct vtTimerNode {
+    const char* thread;        /* name of the thread that the node belongs to */
+    const char* label;         /* label of the timer as shown in the report (e.g. the name of
+                                * an instrumented function), or the name of the thread for a root */
+    const char* const* path;   /* labels from below the root down to this node (depth
+                                * entries); only valid during a visitor call */
+    size_t index;              /* index of the node in visiting order */
+    size_t parent;             /* index of the parent node, SIZE_MAX for a root */
+    unsigned depth;            /* 0 for a root, 1 for its children, ... */
+    unsigned nr_calls;
+    double wall_time;          /* in seconds */
+    unsigned long nr_samples;  /* samples of the sampler while this timer was the innermost one */
+} vtTimerNode;
+
+typedef void (VT_C_CALLCONV *vtTimerVisitor)(const vtTimerNode* node, void* user_data);
+
 VT_C_API void VT_C_CALLCONV vt_last_error_message(char* cstring, const size_t n);
 
 VT_C_API vtErrorCode VT_C_CALLCONV vt_last_error_code();
@@ -37,10 +74,97 @@ VT_C_API vtErrorCode VT_C_CALLCONV vt_timer_tic(const char* name);
 
 VT_C_API vtErrorCode VT_C_CALLCONV vt_timer_toc(const char* name);
 
+/* Timers of all threads with the same role (e.g. "io-worker") are merged into
+ * one tree in the report, instead of one tree per thread. */
+VT_C_API vtErrorCode VT_C_CALLCONV vt_timer_set_thread_role(const char* role);
+
+/* Adds value to the counter with the given name (e.g. "bytes", "items", "flops")
+ * of the currently running timer; the report shows the resulting throughput. */
+VT_C_API vtErrorCode VT_C_CALLCONV vt_timer_count(const char* counter, const double value);
+
 VT_C_API vtErrorCode VT_C_CALLCONV vt_timers_to_cstring(char* cstring, const size_t n);
 
 VT_C_API vtErrorCode VT_C_CALLCONV vt_timers_to_stdout();
 
 VT_C_API vtErrorCode VT_C_CALLCONV vt_timers_reset();
 
+/* Ends the current epoch (phase) and starts a new one, without stopping any timer.
+ * Each thread publishes the timings of the ended epoch at its next tic or toc (or
+ * when it finishes); the calling thread does so immediately. Running timers are
+ * split at the time at which the new epoch started, so calls that span the advance
+ * are divided over both epochs. Until every thread that was timing has made
+ * another timer call or has finished, the reports of the ended epoch are
+ * incomplete. The number of the ended epoch is returned in ended_epoch (epochs are
+ * numbered from 0). A reset also ends the current epoch and discards the timings
+ * of all epochs up to it. */
+VT_C_API vtErrorCode VT_C_CALLCONV vt_timers_advance_epoch(size_t* ended_epoch);
+
+/* Reports the timings of a single epoch, as far as they have been published. Only
+ * the most recent 64 epochs are kept. */
+VT_C_API vtErrorCode VT_C_CALLCONV vt_timers_epoch_to_cstring(const size_t epoch, char* cstring, const size_t n);
+
+VT_C_API vtErrorCode VT_C_CALLCONV vt_timers_epoch_to_stdout(const size_t epoch);
+
+/* Sets the recursion mode of all threads (vtRECURSION_NESTED by default). A thread
+ * only switches to a new mode while none of its timers are running: threads that
+ * are timing, including the calling thread, keep their mode until they have
+ * stopped all their timers. */
+VT_C_API vtErrorCode VT_C_CALLCONV vt_timers_set_recursion_mode(vtRecursionMode mode);
+
+/* Limits the number of timers per thread (0: unlimited, the default). Beyond the
+ * budget, tics on new labels go to an "(overflow)" timer under the current timer,
+ * and so do all tics below it. Labels of timers within the budget are kept in a
+ * process-wide table that grows for the life of the process, also across
+ * vt_timers_reset; folded labels are not kept. */
+VT_C_API vtErrorCode VT_C_CALLCONV vt_timers_set_node_budget(const size_t max_nodes_per_thread);
+
+/* Calls to timers with this name that take longer than the given number of seconds
+ * are recorded as outliers. Existing timers get the budget at the next tic or toc
+ * of their thread. */
+VT_C_API vtErrorCode VT_C_CALLCONV vt_timer_set_budget(const char* name, const double seconds);
+
+/* Calls the callback for each recorded outlier and removes it. The number of outliers
+ * that were dropped because the outlier buffer was full is returned in nr_dropped. */
+VT_C_API vtErrorCode VT_C_CALLCONV vt_timer_outliers_drain(vtTimerOutlierCallback callback, void* user_data, size_t* nr_dropped);
+
+/* The query functions collect the timings of all threads, like the report does, and
+ * read them without formatting. As for the report, all timers of the calling
+ * thread must be stopped. Nodes are visited depth first, the threads in the order
+ * of their names and the children of a node in the order of their labels. The
+ * visitor must not call the report or query functions. */
+VT_C_API vtErrorCode VT_C_CALLCONV vt_timers_visit(vtTimerVisitor visitor, void* user_data);
+
+/* Fills nodes with at most capacity nodes in visiting order (with path set to NULL)
+ * and returns the total number of nodes in nr_nodes; returns vtWARNING if not all
+ * nodes fitted. */
+VT_C_API vtErrorCode VT_C_CALLCONV vt_timers_get_nodes(vtTimerNode* nodes, const size_t capacity, size_t* nr_nodes);
+
+/* Finds the node with the given label path below the root of a thread, e.g.
+ * "solve/assemble" (with the labels as shown in the report), and returns it with path set to NULL. If thread is NULL, the
+ * calls, wall times and samples of the node in all threads are added up; the other fields
+ * are those of the first thread that has the node. Returns vtWARNING if there is
+ * no such node. */
+VT_C_API vtErrorCode VT_C_CALLCONV vt_timers_find(const char* thread, const char* path, vtTimerNode* node);
+
+#ifdef VT_TIMERS_SAMPLER
+/* Starts the sampling profiler (Linux only). Each sampled thread gets a SIGPROF
+ * signal after every 1/frequency seconds of its CPU time, and the sample is counted
+ * for its innermost running timer. With a backtrace_depth (at most 8), that many
+ * functions of the native call stack are recorded too, and the report breaks the
+ * sampled self time of each timer down by call stack. The calling thread is sampled
+ * from now on, and so are other threads from their first timer or their own call.
+ * This installs a SIGPROF signal handler. Note that the kernel may deliver the
+ * samples at most once per scheduler tick (CONFIG_HZ, often 250 per second). */
+VT_C_API vtErrorCode VT_C_CALLCONV vt_sampler_start(const double frequency, const unsigned backtrace_depth);
+
+/* Stops sampling all threads. */
+VT_C_API vtErrorCode VT_C_CALLCONV vt_sampler_stop();
+#endif
+
+#ifdef VT_TIMERS_VIRTUAL_CLOCK
+/* Advances the virtual clock of the calling thread; only available when linking
+ * against the vt_timers_virtual_clock library. */
+VT_C_API vtErrorCode VT_C_CALLCONV vt_virtual_clock_advance(const double seconds);
+#endif
+
 #endif  /* VT_TIMERS_H */
@@ -21,15 +21,76 @@
 #ifndef VT_TIMERS_HPP
 #define VT_TIMERS_HPP
 
+#include <vt/clock.hpp>
 #include <vt/timers.h>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstring>
+#include <functional>
 #include <map>
+#include <memory>
 #include <string>
+#include <vector>
 
 
 namespace vt {
 
+// Labels of timers and counters are interned: each distinct label is stored
+// once per process, in an arena that lives until the end of the program. The
+// table is not bounded and is not cleared by vt_timers_reset, so it grows with
+// every distinct label for the life of the process; labels folded into an
+// overflow timer are not interned.
+VT_TIMERS_ATTR const char* intern_label(const char* label);
+
+// Orders labels by their contents, so that containers keyed by interned labels
+// can be searched with any C string.
+struct LabelLess
+{
+    bool operator()(const char* a, const char* b) const
+    {
+        return std::strcmp(a, b) < 0;
+    }
+};
+
+
+// Number of samples of a timer. The signal handler of the sampler increments it
+// while the thread itself may be reading or taking it, so it is atomic (and
+// lock-free, which is checked in sampler.cpp); it is copied like a plain number.
+class SampleCount
+{
+public:
+    SampleCount() : count_(0) {}
+    SampleCount(const SampleCount& other) : count_(other.load()) {}
+    SampleCount& operator=(const SampleCount& other)
+    {
+        count_.store(other.load(), std::memory_order_relaxed);
+        return *this;
+    }
+
+    unsigned long load() const { return count_.load(std::memory_order_relaxed); }
+    void add(const unsigned long count) { count_.fetch_add(count, std::memory_order_relaxed); }
+    unsigned long take() { return count_.exchange(0, std::memory_order_relaxed); }
+
+private:
+    std::atomic<unsigned long> count_;
+};
+
+
+// Optional hook that turns a stored label into the label shown in reports,
+// e.g. to resolve a label that holds a function address into the function's name.
+typedef std::string (*LabelFormatter)(const char* label);
+VT_TIMERS_ATTR void set_label_formatter(LabelFormatter formatter);
+VT_TIMERS_ATTR std::string format_label(const char* label);
+
+// Finds the demangled name of the function that contains the given code address
+// (with the sampler or the instrument library, see function_names.cpp). Returns
+// false if the function is not exported, and sets module to the file name of the
+// module that contains it then, if known.
+VT_TIMERS_ATTR bool find_function_name(const void* address, std::string& name, std::string& module);
+
+
 class Timer
 {
 public:
@@ -38,31 +99,250 @@ public:
     void start();
     void stop();
 
+    // Collapsed recursion: re-entering a running timer only increases its depth.
+    // The self time of such timers is accounted explicitly, since their children
+    // may contain re-entries of them.
+    void reenter();
+    void leave();
+    void add_self_time(const TimerClock::duration self_time);
+
+    // Work counters (bytes, items, flops, ...) used to report throughput.
+    void add_count(const char* counter, const double value);
+
+    // Records that a tic on a label that did not fit in the node budget was
+    // redirected to this (overflow) timer.
+    void fold(const char* name);
+
+    // Samples of the sampling profiler (sampler.cpp): count_sample is called from
+    // the signal handler while this timer is the innermost running one, and
+    // add_sampled_stack later for the native call stack of a sample.
+    void count_sample();
+    void add_sampled_stack(const char* stack);
+
+    // Looks up the budgets of all timers below this one again, after a budget
+    // was set; see timer_budgets.cpp.
+    void refresh_budgets();
+
+    // Adds the timings, counts and children of another timer to this one.
+    void merge(const Timer& other);
+
+    // Moves the timings and counts recorded so far into phase and continues from
+    // zero, keeping the tree; running timers are split at now (timers that were
+    // started after now are left as they are).
+    void split_phase(Timer& phase, const TimerClock::time_point now);
+
     bool is_running() const;
-    bool has_timer_with_name(const std::string& name) const;
+    unsigned depth() const;
+    unsigned nr_calls() const;
+    unsigned long nr_samples() const;
+    std::chrono::duration<double> wall_time() const;
+    const std::map<const char*, Timer, LabelLess>& children() const;
+    bool has_timer_with_name(const char* name) const;
+    Timer* find_child(const char* name);
     size_t children_count() const;
-    Timer& new_or_existing_child(const std::string& name);
+    bool has_counts_recursive() const;
+    Timer& new_or_existing_child(const char* name);
 
     size_t max_label_length_recursive() const;
-    std::string tree_string(const std::string& name, const size_t level, const size_t label_length) const;
+    // With per_thread_rates, the rates of counters are those of timers merged
+    // over threads, so per thread on average, and labelled as such.
+    std::string tree_string(const std::string& name, const size_t level, const size_t label_length,
+                            const bool per_thread_rates = false) const;
 
     Timer* parent_;
 
 private:
+    // Slow path of stop() for calls that exceed budget_, see timer_budgets.cpp
+    void record_outlier(const TimerClock::time_point end,
+                        const TimerClock::duration elapsed) const;
+    static TimerClock::duration budget_for(const char* name);
+
+    // Estimated number of distinct labels in folded_labels_ (linear counting).
+    double folded_labels_count() const;
+
+    // Number of samples of this timer and all timers below it.
+    unsigned long nr_samples_recursive() const;
+
+    // Data that most timers do not need: the statistics of collapsed recursion,
+    // work counters, sampled call stacks and, for overflow timers, the folded
+    // labels. It is allocated when first needed, so that the tree stays small
+    // when these features are not used.
+    struct Details
+    {
+        Details() : self_time(0.0), max_depth(0) {}
+
+        std::chrono::duration<double> self_time;
+        unsigned max_depth;  // only set for timers that were re-entered
+        std::map<const char*, double, LabelLess> counts;
+        std::map<const char*, unsigned long, LabelLess> sampled_stacks;
+
+        // Bitmap of hashed folded labels; only allocated for overflow timers.
+        std::vector<unsigned char> folded_labels;
+    };
+
+    // Owns the details of a timer, and copies them along with it.
+    class DetailsPtr
+    {
+    public:
+        DetailsPtr() {}
+        DetailsPtr(const DetailsPtr& other) : details_(other ? new Details(*other) : nullptr) {}
+        DetailsPtr(DetailsPtr&& other) : details_(std::move(other.details_)) {}
+        DetailsPtr& operator=(const DetailsPtr& other)
+        {
+            details_.reset(other ? new Details(*other) : nullptr);
+            return *this;
+        }
+        DetailsPtr& operator=(DetailsPtr&& other)
+        {
+            details_ = std::move(other.details_);
+            return *this;
+        }
+
+        explicit operator bool() const { return details_ != nullptr; }
+        Details& operator*() const { return *details_; }
+        Details* operator->() const { return details_.get(); }
+        void reset(Details* details = nullptr) { details_.reset(details); }
+
+    private:
+        std::unique_ptr<Details> details_;
+    };
+
+    Details& details();
+
     bool is_running_;
-    std::map<std::string, Timer> children_;
+    std::map<const char*, Timer, LabelLess> children_;
 
-    std::chrono::time_point<std::chrono::high_resolution_clock> start_;
+    TimerClock::time_point start_;
+    TimerClock::duration budget_;
     std::chrono::duration<double> wall_time_;
     std::chrono::duration<double> cpu_time_;
     unsigned nr_calls_;
+    unsigned depth_;
+    SampleCount nr_samples_;
+    DetailsPtr details_;
 };
 
 
+// The methods on the tic/toc fast path are defined inline, see also timers_inline.hpp
+
+inline void Timer::start()
+{
+    using namespace std::chrono;
+
+    is_running_ = true;
+    start_ = TimerClock::now();
+
+    nr_calls_ += 1;
+    depth_ = 1;
+}
+
+
+inline void Timer::stop()
+{
+    using namespace std::chrono;
+
+    auto end = TimerClock::now();
+    is_running_ = false;
+    depth_ = 0;
+
+    auto elapsed = end - start_;
+    wall_time_ += elapsed;
+
+    if (elapsed > budget_)
+        record_outlier(end, elapsed);
+}
+
+
+inline bool Timer::is_running() const
+{
+    return is_running_;
+}
+
+
+inline unsigned Timer::depth() const
+{
+    return depth_;
+}
+
+
+inline unsigned Timer::nr_calls() const
+{
+    return nr_calls_;
+}
+
+
+inline void Timer::count_sample()
+{
+    nr_samples_.add(1);
+}
+
+
+inline unsigned long Timer::nr_samples() const
+{
+    return nr_samples_.load();
+}
+
+
+inline std::chrono::duration<double> Timer::wall_time() const
+{
+    return wall_time_;
+}
+
+
+inline const std::map<const char*, Timer, LabelLess>& Timer::children() const
+{
+    return children_;
+}
+
+
+inline Timer* Timer::find_child(const char* name)
+{
+    auto child = children_.find(name);
+    return child == children_.end() ? nullptr : &child->second;
+}
+
+
 VT_TIMERS_ATTR void timers_to_stream(std::ostream& stream);
 
 VT_TIMERS_ATTR std::string timers_to_string();
 
+// See vt_timers_advance_epoch; returns the number of the ended epoch.
+VT_TIMERS_ATTR size_t advance_timer_epoch();
+
+VT_TIMERS_ATTR void timers_epoch_to_stream(std::ostream& stream, const size_t epoch);
+
+VT_TIMERS_ATTR std::string timers_epoch_to_string(const size_t epoch);
+
+// See vt_timers_visit, vt_timers_get_nodes and vt_timers_find.
+typedef std::function<void(const vtTimerNode& node)> TimerVisitor;
+VT_TIMERS_ATTR void visit_timers(const TimerVisitor& visitor);
+VT_TIMERS_ATTR std::vector<vtTimerNode> timer_nodes();
+VT_TIMERS_ATTR bool find_timer(const char* thread, const char* path, vtTimerNode& node);
+
+// Removes all recorded outliers from the outlier buffer and returns them.
+VT_TIMERS_ATTR std::vector<vtTimerOutlier> drain_timer_outliers();
+
+
+namespace detail {
+
+// Looks up the budgets of the timers of this thread again if a budget was set
+// since the last time, see timer_budgets.cpp
+void refresh_budgets_if_changed(Timer& toplevel);
+
+}  // namespace detail
+
+
+#ifdef VT_TIMERS_SAMPLER
+namespace detail {
+
+// Called by the timers of a thread, see sampler.cpp
+void sample_this_thread_if_enabled();
+void drain_samples_of_this_thread();
+void stop_sampling_this_thread();
+
+}  // namespace detail
+#endif
+
 
 }  // namespace vt
 
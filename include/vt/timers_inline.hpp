@@ -0,0 +1,114 @@
+// Copyright (c) 2019-2020 VORtech b.v.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef VT_TIMERS_INLINE_HPP
+#define VT_TIMERS_INLINE_HPP
+
+#include <vt/timers.hpp>
+#include <vt/timers.h>
+
+#include <atomic>
+
+// Inline versions of vt_timer_tic and vt_timer_toc for C++ code.
+//
+// The common case (starting an existing timer, stopping a non-recursive timer)
+// is handled inline; errors such as a NULL name are left to the slow path on the thread-local state of the library; everything else
+// is forwarded to the library. Link against the static vt_timers_inline target
+// to avoid calls through the PLT and to access the thread-local state directly.
+// Note: MSVC cannot export thread_local variables from a DLL, so there this
+// header can only be used with the static library.
+
+namespace vt {
+
+namespace detail {
+
+// The running timer of this thread, defined in vt_timers.cpp.
+extern thread_local Timer* current_level;
+
+// Set while the timers of the OpenMP threads are collected.
+extern std::atomic<bool> collecting_timers;
+
+// The current epoch, and the epoch this thread is recording; a thread whose
+// epoch is behind publishes its timings in the slow path.
+extern std::atomic<size_t> epoch;
+extern thread_local size_t thread_epoch;
+
+inline bool epoch_is_current()
+{
+    return thread_epoch == epoch.load(std::memory_order_relaxed);
+}
+
+// The recursion mode of this thread. In collapsed recursion mode, the running
+// timers are kept on a stack by the slow path, so tic and toc always take the
+// slow path then.
+extern thread_local int thread_recursion_mode;
+
+// Incremented whenever a setting changes that each thread applies itself in
+// the slow path (a timer budget is set, the sampler is started, the recursion
+// mode is set), and the generation of the settings this thread applied.
+extern std::atomic<unsigned> settings_generation;
+extern thread_local unsigned thread_settings_generation;
+
+inline bool fast_path_allowed()
+{
+    return epoch_is_current() && thread_recursion_mode == vtRECURSION_NESTED &&
+           thread_settings_generation == settings_generation.load(std::memory_order_relaxed);
+}
+
+VT_TIMERS_ATTR vtErrorCode timer_tic_slow(const char* name);
+VT_TIMERS_ATTR vtErrorCode timer_toc_slow(const char* name);
+
+}  // namespace detail
+
+
+inline vtErrorCode timer_tic(const char* name)
+{
+    Timer* level = detail::current_level;
+    if (level != nullptr && name != nullptr && detail::fast_path_allowed())
+    {
+        Timer* timer = level->find_child(name);
+        if (timer != nullptr && !timer->is_running())
+        {
+            timer->parent_ = level;
+            detail::current_level = timer;
+            timer->start();
+            return vtOK;
+        }
+    }
+    return detail::timer_tic_slow(name);
+}
+
+
+inline vtErrorCode timer_toc(const char* name)
+{
+    Timer* timer = detail::current_level;
+    if (timer != nullptr && name != nullptr && timer->depth() == 1 && timer->parent_ != nullptr &&
+            timer->parent_->find_child(name) != nullptr && detail::fast_path_allowed())
+    {
+        timer->stop();
+        detail::current_level = timer->parent_;
+        return vtOK;
+    }
+    return detail::timer_toc_slow(name);
+}
+
+}  // namespace vt
+
+#endif  // VT_TIMERS_INLINE_HPP
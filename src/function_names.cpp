@@ -0,0 +1,61 @@
+// Copyright (c) 2019-2020 VORtech b.v.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Names of functions by code address, for the sampler (sampler.cpp) and the
+// -finstrument-functions hooks (instrument_functions.cpp). GCC and Clang only.
+
+#include <vt/timers.hpp>
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+
+
+namespace vt {
+
+VT_TIMERS_ATTR bool find_function_name(const void* address, std::string& name, std::string& module)
+{
+    Dl_info info;
+    if (dladdr(address, &info) == 0)
+        return false;
+
+    if (info.dli_sname != nullptr)
+    {
+        int status = 0;
+        char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+        name = (status == 0 && demangled != nullptr) ? demangled : info.dli_sname;
+        std::free(demangled);
+        return true;
+    }
+
+    // Not exported, e.g. a function in an executable linked without -rdynamic
+    if (info.dli_fname != nullptr)
+    {
+        const char* slash = std::strrchr(info.dli_fname, '/');
+        module = slash != nullptr ? slash + 1 : info.dli_fname;
+    }
+    return false;
+}
+
+
+}  // namespace vt
@@ -0,0 +1,382 @@
+// Copyright (c) 2019-2020 VORtech b.v.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Implementation of the -finstrument-functions hooks, which feed the timer tree
+// with a timer per instrumented function. This file itself must be compiled
+// without -finstrument-functions.
+
+#include <vt/instrument.h>
+#include <vt/timers.hpp>
+#include <vt/timers.h>
+#include <vt/timers_inline.hpp>
+#include <vt/error_handling.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <dlfcn.h>
+
+#define VT_NO_INSTRUMENT __attribute__((no_instrument_function))
+
+
+namespace vt {
+
+// Labels of function timers are "fn@" followed by the function's address.
+static const char function_label_prefix[] = "fn@";
+
+// Functions are only timed by average duration once they are called this often.
+static const unsigned min_duration_nr_calls = 100;
+
+struct InstrumentedFunction
+{
+    void* address;
+    const char* label;
+    std::atomic<bool> enabled;
+};
+
+// Substrings of the names of the functions to time, and of those not to time.
+// Replaced as a whole, so that a hook can match them without holding the lock.
+struct FunctionFilters
+{
+    std::vector<std::string> include;
+    std::vector<std::string> exclude;
+
+    VT_NO_INSTRUMENT bool empty() const
+    {
+        return include.empty() && exclude.empty();
+    }
+};
+
+
+// Process-wide registry of instrumented functions. It is never destructed, since
+// the hooks can be called until the very end of the program.
+class FunctionRegistry
+{
+public:
+    VT_NO_INSTRUMENT FunctionRegistry() : min_duration_(0.0)
+    {
+        main_ = dlsym(RTLD_DEFAULT, "main");
+
+        const char* include = std::getenv("VT_INSTRUMENT_INCLUDE");
+        const char* exclude = std::getenv("VT_INSTRUMENT_EXCLUDE");
+        filters_ = make_filters(include, exclude);
+
+        const char* min_duration = std::getenv("VT_INSTRUMENT_MIN_DURATION");
+        if (min_duration != nullptr)
+            min_duration_.store(std::atof(min_duration));
+    }
+
+    VT_NO_INSTRUMENT InstrumentedFunction* function(void* address)
+    {
+        std::shared_ptr<const FunctionFilters> filters;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            auto existing = functions_.find(address);
+            if (existing != functions_.end())
+                return existing->second;
+            filters = filters_;
+        }
+
+        // With filters, the name of a function is resolved (dladdr and demangling)
+        // to match them when it is first called, so in the hook, but without
+        // holding the lock: the hooks of other threads do not wait for it.
+        std::string name;
+        if (address != main_ && !filters->empty())
+            name = resolve(address);
+
+        std::stringstream ss;
+        ss << function_label_prefix << address;
+        const char* label = intern_label(ss.str().c_str());
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto existing = functions_.find(address);
+        if (existing != functions_.end())
+            return existing->second;
+
+        if (!name.empty())
+            names_.emplace(label, name);
+
+        InstrumentedFunction* function = new InstrumentedFunction;
+        function->address = address;
+        function->label = label;
+        function->enabled.store(passes_filter(function));
+        functions_.emplace(address, function);
+        return function;
+    }
+
+    VT_NO_INSTRUMENT void set_filter(const char* include, const char* exclude)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        filters_ = make_filters(include, exclude);
+        enable_filtered_functions();
+    }
+
+    VT_NO_INSTRUMENT double min_duration() const
+    {
+        return min_duration_.load(std::memory_order_relaxed);
+    }
+
+    // Functions that were disabled for being too short are timed again.
+    VT_NO_INSTRUMENT void set_min_duration(const double seconds)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        min_duration_.store(seconds);
+        enable_filtered_functions();
+    }
+
+    // Name of the function whose address is in a function label.
+    VT_NO_INSTRUMENT std::string name(const char* label)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        void* address = reinterpret_cast<void*>(static_cast<std::uintptr_t>(
+            std::strtoull(label + std::strlen(function_label_prefix), nullptr, 16)));
+        return cached_name(label, address);
+    }
+
+private:
+    static VT_NO_INSTRUMENT std::shared_ptr<const FunctionFilters> make_filters(const char* include,
+                                                                               const char* exclude)
+    {
+        std::shared_ptr<FunctionFilters> filters = std::make_shared<FunctionFilters>();
+        filters->include = split(include);
+        filters->exclude = split(exclude);
+        return filters;
+    }
+
+    static VT_NO_INSTRUMENT std::vector<std::string> split(const char* patterns)
+    {
+        std::vector<std::string> split_patterns;
+        if (patterns == nullptr)
+            return split_patterns;
+
+        std::stringstream ss(patterns);
+        std::string pattern;
+        while (std::getline(ss, pattern, ','))
+            if (!pattern.empty())
+                split_patterns.push_back(pattern);
+        return split_patterns;
+    }
+
+    static VT_NO_INSTRUMENT std::string resolve(void* address)
+    {
+        std::string name;
+        std::string module;
+        if (find_function_name(address, name, module))
+            return name;
+
+        std::stringstream ss;
+        ss << address;
+        return ss.str();
+    }
+
+    // Names are resolved only once per function. Called with the lock held.
+    VT_NO_INSTRUMENT std::string cached_name(const char* label, void* address)
+    {
+        auto existing = names_.find(label);
+        if (existing != names_.end())
+            return existing->second;
+
+        std::string name = resolve(address);
+        names_.emplace(label, name);
+        return name;
+    }
+
+    VT_NO_INSTRUMENT void enable_filtered_functions()
+    {
+        for (auto& function : functions_)
+            function.second->enabled.store(passes_filter(function.second));
+    }
+
+    // Called with the lock held; only resolves the name of the function if it
+    // was not resolved yet, i.e. if the filters were set after its first call.
+    VT_NO_INSTRUMENT bool passes_filter(const InstrumentedFunction* function)
+    {
+        if (function->address == main_)
+            return false;
+        const FunctionFilters& filters = *filters_;
+        if (filters.empty())
+            return true;
+
+        const std::string name = cached_name(function->label, function->address);
+        auto matches = [&name](const std::string& pattern)
+        {
+            return name.find(pattern) != std::string::npos;
+        };
+
+        bool included = filters.include.empty() ||
+                        std::any_of(filters.include.begin(), filters.include.end(), matches);
+        bool excluded = std::any_of(filters.exclude.begin(), filters.exclude.end(), matches);
+        return included && !excluded;
+    }
+
+    std::mutex mutex_;
+    std::unordered_map<void*, InstrumentedFunction*> functions_;
+    std::map<const char*, std::string> names_;
+    std::shared_ptr<const FunctionFilters> filters_;
+    std::atomic<double> min_duration_;
+    void* main_;
+};
+
+static VT_NO_INSTRUMENT FunctionRegistry& registry()
+{
+    static FunctionRegistry* registry = new FunctionRegistry;
+    return *registry;
+}
+
+
+// Per-thread cache of the registry, and the stack of instrumented calls, which
+// records for each call whether it was timed. Both are plain arrays, so that
+// they need no construction or destruction and can be used at any time.
+static const size_t cache_size = 1024;
+static const size_t max_call_depth = 4096;
+
+struct CachedFunction
+{
+    void* address;
+    InstrumentedFunction* function;
+};
+
+static thread_local CachedFunction function_cache[cache_size];
+static thread_local bool call_is_timed[max_call_depth];
+static thread_local size_t call_depth = 0;
+
+// Set while a hook runs. The library may call instrumented copies of inline
+// functions (e.g. of the standard library) in the program, which must not
+// re-enter the hooks.
+static thread_local bool in_hook = false;
+
+struct HookGuard
+{
+    VT_NO_INSTRUMENT HookGuard() { in_hook = true; }
+    VT_NO_INSTRUMENT ~HookGuard() { in_hook = false; }
+};
+
+static VT_NO_INSTRUMENT InstrumentedFunction* instrumented_function(void* address)
+{
+    CachedFunction& cached = function_cache[(reinterpret_cast<std::uintptr_t>(address) >> 4) % cache_size];
+    if (cached.address != address)
+    {
+        cached.function = registry().function(address);
+        cached.address = address;
+    }
+    return cached.function;
+}
+
+
+static VT_NO_INSTRUMENT std::string format_function_label(const char* label)
+{
+    if (std::strncmp(label, function_label_prefix, std::strlen(function_label_prefix)) != 0)
+        return label;
+    return registry().name(label);
+}
+
+// The report shows function names instead of addresses as soon as this library is loaded.
+struct InstallLabelFormatter
+{
+    VT_NO_INSTRUMENT InstallLabelFormatter()
+    {
+        set_label_formatter(format_function_label);
+    }
+};
+
+static InstallLabelFormatter install_label_formatter;
+
+
+}  // namespace vt
+
+
+
+VT_C_NAME_MANGLING VT_NO_INSTRUMENT void __cyg_profile_func_enter(void* function_address, void*)
+{
+    using namespace vt;
+
+    if (in_hook)
+        return;
+    HookGuard guard;
+
+    size_t depth = call_depth++;
+    if (depth >= max_call_depth)
+        return;
+
+    InstrumentedFunction* function = instrumented_function(function_address);
+    call_is_timed[depth] = function->enabled.load(std::memory_order_relaxed) &&
+                           timer_tic(function->label) == vtOK;
+}
+
+
+VT_C_NAME_MANGLING VT_NO_INSTRUMENT void __cyg_profile_func_exit(void* function_address, void*)
+{
+    using namespace vt;
+
+    if (in_hook)
+        return;
+    HookGuard guard;
+
+    if (call_depth == 0)
+        return;  // entered before the hooks were active
+    size_t depth = --call_depth;
+    if (depth >= max_call_depth || !call_is_timed[depth])
+        return;
+
+    InstrumentedFunction* function = instrumented_function(function_address);
+    Timer* timer = detail::current_level;
+    if (timer_toc(function->label) != vtOK)
+        return;
+
+    // Functions that are too short on average are not timed anymore.
+    double min_duration = registry().min_duration();
+    if (min_duration > 0.0 && timer->depth() == 0 && timer->nr_calls() >= min_duration_nr_calls &&
+            timer->wall_time().count() < min_duration * timer->nr_calls())
+        function->enabled.store(false, std::memory_order_relaxed);
+}
+
+
+VT_C_API vtErrorCode VT_C_CALLCONV vt_instrument_set_filter(const char* include, const char* exclude) VT_EXCEPT_TO_ERRORCODE(
+{
+    vt::registry().set_filter(include, exclude);
+
+    return vtOK;
+})
+
+
+VT_C_API vtErrorCode VT_C_CALLCONV vt_instrument_set_min_duration(const double seconds) VT_EXCEPT_TO_ERRORCODE(
+{
+    if (seconds < 0.0)
+        throw std::runtime_error("Minimum duration should not be negative!");
+
+    vt::registry().set_min_duration(seconds);
+
+    return vtOK;
+})
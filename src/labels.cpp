@@ -0,0 +1,154 @@
+// Copyright (c) 2019-2020 VORtech b.v.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <vt/timers.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+
+namespace vt {
+
+// FNV-1a hash of a C string
+struct LabelHash
+{
+    size_t operator()(const char* label) const
+    {
+        size_t hash = 14695981039346656037ull & ~size_t(0);
+        for (const char* c = label; *c != '\0'; ++c)
+        {
+            hash ^= static_cast<unsigned char>(*c);
+            hash *= 1099511628211ull & ~size_t(0);
+        }
+        return hash;
+    }
+};
+
+struct LabelEqual
+{
+    bool operator()(const char* a, const char* b) const
+    {
+        return std::strcmp(a, b) == 0;
+    }
+};
+
+
+// Process-wide set of labels. The characters are copied into large chunks
+// that are never freed, so interned labels stay valid and never move.
+class LabelTable
+{
+public:
+    LabelTable() : free_(nullptr), free_size_(0) {}
+
+    const char* intern(const char* label)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto existing = labels_.find(label);
+        if (existing != labels_.end())
+            return *existing;
+
+        const size_t size = std::strlen(label) + 1;
+        char* copy = allocate(size);
+        std::memcpy(copy, label, size);
+        labels_.insert(copy);
+        return copy;
+    }
+
+private:
+    static const size_t chunk_size = 64 * 1024;
+
+    char* allocate(const size_t size)
+    {
+        if (size > free_size_)
+        {
+            const size_t new_chunk_size = std::max(chunk_size, size);
+            chunks_.emplace_back(new char[new_chunk_size]);
+            free_ = chunks_.back().get();
+            free_size_ = new_chunk_size;
+        }
+        char* memory = free_;
+        free_ += size;
+        free_size_ -= size;
+        return memory;
+    }
+
+    std::mutex mutex_;
+    std::unordered_set<const char*, LabelHash, LabelEqual> labels_;
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    char* free_;
+    size_t free_size_;
+};
+
+const size_t LabelTable::chunk_size;
+
+
+VT_TIMERS_ATTR const char* intern_label(const char* label)
+{
+    // Constructed on first use, so that labels can be interned during static
+    // initialization; deliberately never destructed, since thread_local timers
+    // may refer to the labels until the very end of the program.
+    static LabelTable* table = new LabelTable;
+    return table->intern(label);
+}
+
+
+// Folded labels are hashed into a bitmap of fixed size, so that the number of
+// distinct folded labels can be estimated without storing them (linear counting).
+static const size_t folded_labels_bits = 4096;
+
+
+void Timer::fold(const char* name)
+{
+    std::vector<unsigned char>& folded_labels = details().folded_labels;
+    if (folded_labels.empty())
+        folded_labels.resize(folded_labels_bits / 8, 0);
+
+    size_t bit = LabelHash()(name) % folded_labels_bits;
+    folded_labels[bit / 8] = static_cast<unsigned char>(folded_labels[bit / 8] | (1u << (bit % 8)));
+}
+
+
+double Timer::folded_labels_count() const
+{
+    if (!details_)
+        return 0.0;
+
+    size_t nr_bits = details_->folded_labels.size() * 8;
+    size_t nr_zeros = 0;
+    for (unsigned char byte : details_->folded_labels)
+        for (unsigned i = 0; i < 8; ++i)
+            if ((byte & (1u << i)) == 0)
+                ++nr_zeros;
+
+    // beyond the range of the estimate if all bits are set
+    const double m = static_cast<double>(nr_bits);
+    if (nr_zeros == 0)
+        return m * std::log(m);
+    return -m * std::log(static_cast<double>(nr_zeros) / m);
+}
+
+
+}  // namespace vt
@@ -0,0 +1,136 @@
+// Copyright (c) 2019-2020 VORtech b.v.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// OMPT tool that times OpenMP parallel regions, worksharing constructs and
+// synchronization waits in the timer tree of the thread that executes them.
+//
+// The OpenMP runtime looks for ompt_start_tool when it initializes. Only
+// runtimes that implement OMPT (e.g. LLVM's libomp, also when used by GCC
+// compiled code) call it; with libgomp the tool is simply never started.
+// The tool can be switched off at run time with OMP_TOOL=disabled.
+
+#include <vt/timers.hpp>
+#include <vt/timers.h>
+#include <vt/timers_inline.hpp>
+
+#include <omp-tools.h>
+
+
+namespace vt {
+
+static void begin_region(const char* label)
+{
+    // The library's own parallel region that collects the timers of the
+    // OpenMP threads is not timed.
+    if (!detail::collecting_timers.load(std::memory_order_relaxed))
+        timer_tic(label);
+}
+
+static void end_region(const char* label)
+{
+    // End events are also handled while collecting: the runtime may report
+    // the end of a previous region only when the next one starts.
+    timer_toc(label);
+}
+
+static void region(const ompt_scope_endpoint_t endpoint, const char* label)
+{
+    if (endpoint == ompt_scope_begin)
+        begin_region(label);
+    else if (endpoint == ompt_scope_end)
+        end_region(label);
+}
+
+
+static void on_implicit_task(ompt_scope_endpoint_t endpoint, ompt_data_t*, ompt_data_t*,
+                             unsigned int, unsigned int, int flags)
+{
+    // The initial task spans the whole program and is not timed.
+    if ((flags & static_cast<int>(ompt_task_initial)) == 0)
+        region(endpoint, "omp parallel");
+}
+
+
+static void on_work(ompt_work_t wstype, ompt_scope_endpoint_t endpoint, ompt_data_t*, ompt_data_t*,
+                    uint64_t, const void*)
+{
+    switch (wstype)
+    {
+        case ompt_work_loop:            region(endpoint, "omp for"); break;
+        case ompt_work_sections:        region(endpoint, "omp sections"); break;
+        case ompt_work_single_executor: region(endpoint, "omp single"); break;
+        case ompt_work_single_other:    break;  // threads that skip the single block
+        case ompt_work_workshare:       region(endpoint, "omp workshare"); break;
+        case ompt_work_distribute:      region(endpoint, "omp distribute"); break;
+        case ompt_work_taskloop:        region(endpoint, "omp taskloop"); break;
+        default:                        region(endpoint, "omp work"); break;
+    }
+}
+
+
+// Only the time spent waiting is timed, so that the barrier timers show the
+// wait time, and thus the load imbalance, per thread.
+static void on_sync_region_wait(ompt_sync_region_t kind, ompt_scope_endpoint_t endpoint,
+                                ompt_data_t*, ompt_data_t*, const void*)
+{
+    switch (kind)
+    {
+        case ompt_sync_region_barrier_explicit:        region(endpoint, "omp barrier"); break;
+        case ompt_sync_region_barrier_implicit_workshare:
+        case ompt_sync_region_barrier_implicit_parallel:
+        case ompt_sync_region_barrier_teams:           region(endpoint, "omp implicit barrier"); break;
+        case ompt_sync_region_taskwait:                region(endpoint, "omp taskwait"); break;
+        case ompt_sync_region_taskgroup:               region(endpoint, "omp taskgroup"); break;
+        case ompt_sync_region_reduction:               region(endpoint, "omp reduction"); break;
+        // libomp reports all barriers of GCC compiled code (through its
+        // GOMP_barrier compatibility layer) as implementation barriers
+        case ompt_sync_region_barrier_implementation:  region(endpoint, "omp runtime barrier"); break;
+        default:                                       region(endpoint, "omp barrier"); break;
+    }
+}
+
+
+static int initialize(ompt_function_lookup_t lookup, int, ompt_data_t*)
+{
+    ompt_set_callback_t set_callback = reinterpret_cast<ompt_set_callback_t>(lookup("ompt_set_callback"));
+    if (set_callback == nullptr)
+        return 0;
+
+    set_callback(ompt_callback_implicit_task, reinterpret_cast<ompt_callback_t>(on_implicit_task));
+    set_callback(ompt_callback_work, reinterpret_cast<ompt_callback_t>(on_work));
+    set_callback(ompt_callback_sync_region_wait, reinterpret_cast<ompt_callback_t>(on_sync_region_wait));
+
+    return 1;  // keep the tool active
+}
+
+
+static void finalize(ompt_data_t*)
+{
+}
+
+
+}  // namespace vt
+
+
+VT_C_API ompt_start_tool_result_t* ompt_start_tool(unsigned int, const char*)
+{
+    static ompt_start_tool_result_t result = { vt::initialize, vt::finalize, ompt_data_none };
+    return &result;
+}
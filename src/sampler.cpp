@@ -0,0 +1,326 @@
+// Copyright (c) 2019-2020 VORtech b.v.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Sampling profiler. A POSIX timer per thread sends SIGPROF to that thread after
+// every sampling period of its CPU time. The signal handler counts a sample for
+// the innermost running timer of the thread (current_level) and optionally
+// records the native call stack in a buffer of the thread, which the thread
+// itself turns into labelled call stacks when its timers are collected.
+// Linux only, because of SIGEV_THREAD_ID.
+
+#include <vt/timers.hpp>
+#include <vt/timers.h>
+#include <vt/timers_inline.hpp>
+#include <vt/error_handling.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <execinfo.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+
+namespace vt {
+
+using detail::current_level;
+
+static_assert(ATOMIC_LONG_LOCK_FREE == 2, "The signal handler needs lock-free sample counts");
+
+static const unsigned max_backtrace_depth = 8;
+
+// Frames of the signal handler itself and of the signal trampoline.
+static const int nr_signal_frames = 2;
+
+static std::atomic<bool> sampler_enabled(false);
+static std::atomic<long> sampling_period_ns(0);
+static std::atomic<unsigned> backtrace_depth(0);
+
+struct Sample
+{
+    Timer* timer;
+    int nr_frames;
+    void* frames[max_backtrace_depth];
+};
+
+// Samples with a call stack of one thread. The signal handler adds samples at
+// head, the thread itself removes them at tail; samples are dropped when full.
+struct SampleBuffer
+{
+    static const size_t capacity = 1024;
+
+    SampleBuffer() : head(0), tail(0) {}
+
+    Sample samples[capacity];
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+};
+
+static thread_local SampleBuffer* sample_buffer = nullptr;
+
+// The timers of all sampled threads, so that they can all be (dis)armed.
+static std::vector<timer_t> sampling_timers;
+static std::mutex sampling_timers_mutex;
+
+
+static void arm(timer_t timer, const long period_ns)
+{
+    itimerspec spec;
+    spec.it_interval.tv_sec = period_ns / 1000000000L;
+    spec.it_interval.tv_nsec = period_ns % 1000000000L;
+    spec.it_value = spec.it_interval;
+    if (timer_settime(timer, 0, &spec, nullptr) != 0)
+        throw std::runtime_error("Could not set the sampling timer!");
+}
+
+
+// Note: only async-signal-safe code here. The thread-local variables have
+// already been accessed by this thread when its sampling timer was created.
+static void take_sample(int, siginfo_t*, void*)
+{
+    const int saved_errno = errno;
+
+    Timer* timer = current_level;
+    if (timer != nullptr)
+    {
+        timer->count_sample();
+
+        SampleBuffer* buffer = sample_buffer;
+        const unsigned depth = backtrace_depth.load(std::memory_order_relaxed);
+        if (buffer != nullptr && depth > 0)
+        {
+            const size_t head = buffer->head.load(std::memory_order_relaxed);
+            if (head - buffer->tail.load(std::memory_order_acquire) < SampleBuffer::capacity)
+            {
+                void* frames[max_backtrace_depth + nr_signal_frames];
+                const int nr_frames = backtrace(frames, static_cast<int>(depth) + nr_signal_frames);
+
+                Sample& sample = buffer->samples[head % SampleBuffer::capacity];
+                sample.timer = timer;
+                sample.nr_frames = std::max(0, nr_frames - nr_signal_frames);
+                for (int i = 0; i < sample.nr_frames; ++i)
+                    sample.frames[i] = frames[i + nr_signal_frames];
+                buffer->head.store(head + 1, std::memory_order_release);
+            }
+        }
+    }
+
+    errno = saved_errno;
+}
+
+
+// Name of the function that contains the given code address.
+static std::string function_name(void* address)
+{
+    static std::map<void*, std::string> names;
+    static std::mutex names_mutex;
+    std::lock_guard<std::mutex> lock(names_mutex);
+
+    auto existing = names.find(address);
+    if (existing != names.end())
+        return existing->second;
+
+    // samples in functions that are not exported are grouped per module
+    std::string name;
+    std::string module;
+    if (!find_function_name(address, name, module))
+        name = module.empty() ? "??" : "?? (" + module + ")";
+    names.emplace(address, name);
+    return name;
+}
+
+
+// Turns the samples in the buffer of this thread into call stacks of their timers.
+static void drain_samples()
+{
+    SampleBuffer* buffer = sample_buffer;
+    if (buffer == nullptr)
+        return;
+
+    const size_t head = buffer->head.load(std::memory_order_acquire);
+    for (size_t i = buffer->tail.load(std::memory_order_relaxed); i != head; ++i)
+    {
+        const Sample& sample = buffer->samples[i % SampleBuffer::capacity];
+
+        // the callers' frames are return addresses, which may be past their function
+        std::string stack;
+        for (int frame = 0; frame < sample.nr_frames; ++frame)
+        {
+            char* address = static_cast<char*>(sample.frames[frame]);
+            if (frame > 0)
+                stack += " < ";
+            stack += function_name(frame == 0 ? address : address - 1);
+        }
+        if (!stack.empty())
+            sample.timer->add_sampled_stack(stack.c_str());
+    }
+    buffer->tail.store(head, std::memory_order_release);
+}
+
+
+// The sampling timer of this thread.
+class SampledThread
+{
+public:
+    SampledThread() : is_sampled_(false), timer_() {}
+
+    ~SampledThread()
+    {
+        stop();
+    }
+
+    void start()
+    {
+        if (is_sampled_)
+            return;
+
+        sample_buffer = new SampleBuffer;
+        Timer* volatile level = current_level;  // access the thread-local state before any signal
+        static_cast<void>(level);
+
+        sigevent event;
+        std::memset(&event, 0, sizeof(event));
+        event.sigev_notify = SIGEV_THREAD_ID;
+        event.sigev_signo = SIGPROF;
+        event.sigev_notify_thread_id = static_cast<pid_t>(syscall(SYS_gettid));
+        if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &timer_) != 0)
+        {
+            delete sample_buffer;
+            sample_buffer = nullptr;
+            throw std::runtime_error("Could not create a sampling timer for this thread!");
+        }
+        is_sampled_ = true;
+
+        std::lock_guard<std::mutex> lock(sampling_timers_mutex);
+        sampling_timers.push_back(timer_);
+        if (sampler_enabled.load())
+            arm(timer_, sampling_period_ns.load());
+    }
+
+    void stop()
+    {
+        if (!is_sampled_)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(sampling_timers_mutex);
+            sampling_timers.erase(std::find(sampling_timers.begin(), sampling_timers.end(), timer_));
+            timer_delete(timer_);
+        }
+        is_sampled_ = false;
+
+        drain_samples();
+        SampleBuffer* buffer = sample_buffer;
+        sample_buffer = nullptr;
+        delete buffer;
+    }
+
+private:
+    bool is_sampled_;
+    timer_t timer_;
+};
+
+static thread_local SampledThread sampled_thread;
+
+
+void detail::sample_this_thread_if_enabled()
+{
+    if (sampler_enabled.load(std::memory_order_relaxed))
+        sampled_thread.start();
+}
+
+
+void detail::drain_samples_of_this_thread()
+{
+    drain_samples();
+}
+
+
+void detail::stop_sampling_this_thread()
+{
+    sampled_thread.stop();
+}
+
+}  // namespace vt
+
+
+VT_C_API vtErrorCode VT_C_CALLCONV vt_sampler_start(const double frequency, const unsigned backtrace_depth) VT_EXCEPT_TO_ERRORCODE(
+{
+    using namespace vt;
+
+    if (!(frequency > 0.0 && frequency <= 1e6))
+        throw std::runtime_error("Sampling frequency should be between 0 and 1e6 per second!");
+    if (backtrace_depth > max_backtrace_depth)
+        throw std::runtime_error("Backtrace depth of samples should be at most 8!");
+
+    // the first call of backtrace may allocate, which is not allowed in the handler
+    void* frame;
+    backtrace(&frame, 1);
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_sigaction = take_sample;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, nullptr) != 0)
+        throw std::runtime_error("Could not install the SIGPROF handler!");
+
+    vt::backtrace_depth.store(backtrace_depth);
+    sampling_period_ns.store(std::max(1L, static_cast<long>(1e9 / frequency)));
+    sampler_enabled.store(true);
+
+    // threads that are already timing start their sampling timer in the slow
+    // path of their next tic or toc; new threads at their first tic
+    sampled_thread.start();
+    detail::settings_generation.fetch_add(1, std::memory_order_release);
+
+    std::lock_guard<std::mutex> lock(sampling_timers_mutex);
+    for (timer_t timer : sampling_timers)
+        arm(timer, sampling_period_ns.load());
+
+    return vtOK;
+})
+
+
+VT_C_API vtErrorCode VT_C_CALLCONV vt_sampler_stop() VT_EXCEPT_TO_ERRORCODE(
+{
+    using namespace vt;
+
+    sampler_enabled.store(false);
+
+    std::lock_guard<std::mutex> lock(sampling_timers_mutex);
+    for (timer_t timer : sampling_timers)
+        arm(timer, 0);
+
+    return vtOK;
+})
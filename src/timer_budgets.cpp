@@ -0,0 +1,261 @@
+// Copyright (c) 2019-2020 VORtech b.v.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <vt/timers.hpp>
+#include <vt/timers.h>
+#include <vt/timers_inline.hpp>
+#include <vt/error_handling.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace vt {
+
+// Budgets per timer name; looked up when a timer is created, and for all
+// timers of a thread when it sees new settings in the slow path.
+static std::map<std::string, TimerClock::duration> budgets;
+static std::mutex budgets_mutex;
+static std::atomic<bool> any_budgets(false);
+
+// Incremented whenever a budget is set, and the generation of the budgets of
+// the timers of this thread.
+static std::atomic<unsigned> budgets_generation(0);
+static thread_local unsigned thread_budgets_generation = 0;
+
+
+// Bounded multi-producer queue of outliers (D. Vyukov's bounded MPMC queue).
+// Threads that exceed a budget never block: if the queue is full, the outlier
+// is dropped and counted instead.
+class OutlierQueue
+{
+public:
+    OutlierQueue() : enqueue_pos_(0), dequeue_pos_(0), nr_dropped_(0)
+    {
+        for (size_t i = 0; i < capacity; ++i)
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    void push(const vtTimerOutlier& outlier)
+    {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell& cell = cells_[pos % capacity];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            if (sequence == pos)
+            {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.outlier = outlier;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return;
+                }
+            }
+            else if (sequence < pos)
+            {
+                nr_dropped_.fetch_add(1, std::memory_order_relaxed);  // queue is full
+                return;
+            }
+            else
+            {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool pop(vtTimerOutlier& outlier)
+    {
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell& cell = cells_[pos % capacity];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            if (sequence == pos + 1)
+            {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    outlier = cell.outlier;
+                    cell.sequence.store(pos + capacity, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (sequence < pos + 1)
+            {
+                return false;  // queue is empty
+            }
+            else
+            {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    size_t take_nr_dropped()
+    {
+        return nr_dropped_.exchange(0, std::memory_order_relaxed);
+    }
+
+private:
+    static const size_t capacity = 1024;
+
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        vtTimerOutlier outlier;
+    };
+
+    Cell cells_[capacity];
+    std::atomic<size_t> enqueue_pos_;
+    std::atomic<size_t> dequeue_pos_;
+    std::atomic<size_t> nr_dropped_;
+};
+
+static OutlierQueue outliers;
+
+
+TimerClock::duration Timer::budget_for(const char* name)
+{
+    // without any budgets, creating a timer takes neither the lock nor a string
+    if (!any_budgets.load(std::memory_order_acquire))
+        return TimerClock::duration::max();
+
+    std::lock_guard<std::mutex> lock(budgets_mutex);
+    auto budget = budgets.find(name);
+    if (budget == budgets.end())
+        return TimerClock::duration::max();
+    return budget->second;
+}
+
+
+void Timer::refresh_budgets()
+{
+    for (auto& child : children_)
+    {
+        child.second.budget_ = budget_for(child.first);
+        child.second.refresh_budgets();
+    }
+}
+
+
+void detail::refresh_budgets_if_changed(Timer& toplevel)
+{
+    unsigned generation = budgets_generation.load(std::memory_order_acquire);
+    if (thread_budgets_generation != generation)
+    {
+        thread_budgets_generation = generation;
+        toplevel.refresh_budgets();
+    }
+}
+
+
+void Timer::record_outlier(const TimerClock::time_point end,
+                           const TimerClock::duration elapsed) const
+{
+    using namespace std::chrono;
+
+    vtTimerOutlier outlier;
+    outlier.timestamp = duration<double>(end.time_since_epoch()).count();
+    outlier.duration = duration<double>(elapsed).count();
+    outlier.budget = duration<double>(budget_).count();
+    outlier.thread = std::hash<std::thread::id>()(std::this_thread::get_id());
+
+    // The label path is found by looking up each timer in its parent.
+    std::vector<const char*> labels;
+    for (const Timer* timer = this; timer->parent_ != nullptr; timer = timer->parent_)
+    {
+        for (const auto& sibling : timer->parent_->children_)
+        {
+            if (&sibling.second == timer)
+            {
+                labels.push_back(sibling.first);
+                break;
+            }
+        }
+    }
+
+    std::string path;
+    for (auto label = labels.rbegin(); label != labels.rend(); ++label)
+    {
+        if (!path.empty())
+            path += "/";
+        path += *label;
+    }
+    strncpy(outlier.path, path.c_str(), sizeof(outlier.path) - 1);
+    outlier.path[sizeof(outlier.path) - 1] = '\0';
+
+    outliers.push(outlier);
+}
+
+
+VT_TIMERS_ATTR std::vector<vtTimerOutlier> drain_timer_outliers()
+{
+    std::vector<vtTimerOutlier> drained;
+    vtTimerOutlier outlier;
+    while (outliers.pop(outlier))
+        drained.push_back(outlier);
+    return drained;
+}
+
+
+}  // namespace vt
+
+
+
+VT_C_API vtErrorCode VT_C_CALLCONV vt_timer_set_budget(const char* name, const double seconds) VT_EXCEPT_TO_ERRORCODE(
+{
+    using namespace vt;
+    using namespace std::chrono;
+
+    if (!(seconds > 0.0))
+        throw std::runtime_error("Timer budget should be positive!");
+
+    std::lock_guard<std::mutex> lock(budgets_mutex);
+    budgets[name] = duration_cast<TimerClock::duration>(duration<double>(seconds));
+    any_budgets.store(true, std::memory_order_release);
+    budgets_generation.fetch_add(1, std::memory_order_release);
+    detail::settings_generation.fetch_add(1, std::memory_order_release);
+
+    return vtOK;
+})
+
+
+VT_C_API vtErrorCode VT_C_CALLCONV vt_timer_outliers_drain(vtTimerOutlierCallback callback, void* user_data, size_t* nr_dropped) VT_EXCEPT_TO_ERRORCODE(
+{
+    using namespace vt;
+
+    vtTimerOutlier outlier;
+    while (outliers.pop(outlier))
+        callback(&outlier, user_data);
+
+    size_t dropped = outliers.take_nr_dropped();
+    if (nr_dropped != nullptr)
+        *nr_dropped = dropped;
+
+    return vtOK;
+})
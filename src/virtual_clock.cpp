@@ -0,0 +1,62 @@
+// Copyright (c) 2019-2020 VORtech b.v.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <vt/clock.hpp>
+#include <vt/timers.h>
+#include <vt/error_handling.hpp>
+
+#include <chrono>
+#include <stdexcept>
+
+
+namespace vt {
+
+// Virtual time of this thread
+static thread_local VirtualClock::duration virtual_time(0);
+
+const bool VirtualClock::is_steady;
+
+
+VirtualClock::time_point VirtualClock::now()
+{
+    return time_point(virtual_time);
+}
+
+
+void VirtualClock::advance(const duration elapsed)
+{
+    if (elapsed < duration::zero())
+        throw std::runtime_error("The virtual clock cannot go back in time!");
+
+    virtual_time += elapsed;
+}
+
+}  // namespace vt
+
+
+VT_C_API vtErrorCode VT_C_CALLCONV vt_virtual_clock_advance(const double seconds) VT_EXCEPT_TO_ERRORCODE(
+{
+    using namespace vt;
+    using namespace std::chrono;
+
+    VirtualClock::advance(duration_cast<VirtualClock::duration>(duration<double>(seconds)));
+
+    return vtOK;
+})
@@ -20,6 +20,7 @@
 
 #include <vt/timers.hpp>
 #include <vt/timers.h>
+#include <vt/timers_inline.hpp>
 #include <vt/error_handling.hpp>
 
 #include <chrono>
@@ -32,36 +33,279 @@
 #include <sstream>
 #include <thread>
 #include <mutex>
+#include <set>
+#include <atomic>
 #include <cstring>
 
 #include <omp.h>
+#ifdef VT_TIMERS_OMPT
+#include <omp-tools.h>
+#endif
+
+#ifdef VT_TIMERS_OMPT
+VT_C_API ompt_start_tool_result_t* ompt_start_tool(unsigned int omp_version, const char* runtime_version);
+#endif
 
 namespace vt {
 
+#ifdef VT_TIMERS_OMPT
+// The OpenMP runtime looks up ompt_start_tool (ompt_tool.cpp) by name, so no
+// code refers to it, and linkers would leave the tool out of programs that link
+// a static vt_timers library. This exported reference makes them take it along.
+namespace detail {
+extern ompt_start_tool_result_t* (* const ompt_tool_anchor)(unsigned int, const char*);
+ompt_start_tool_result_t* (* const ompt_tool_anchor)(unsigned int, const char*) = &ompt_start_tool;
+}
+#endif
+
 // Note: statics are destructed after thread_locals, according to the standard.
 
-// There is a global set of Timers, initially empty.
-static std::map<std::thread::id, Timer> timers;
+// Threads are identified by their role, or by their id if they have no role;
+// a thread may get the id of a thread that finished before.
+struct ThreadKey
+{
+    std::string role;
+    std::thread::id id;
+
+    bool operator<(const ThreadKey& other) const
+    {
+        return role != other.role ? role < other.role : id < other.id;
+    }
+};
+typedef std::map<ThreadKey, Timer> ThreadTimers;
+
+// There is a global set of Timers, initially empty, with one Timer per thread
+// or per thread role. It is only accessed by the reporting thread.
+static ThreadTimers timers;
+static std::mutex timers_mutex;
+
+// The same, but per epoch, for the most recent epochs. Timings of epochs before
+// first_kept_epoch (i.e. before the last reset) are discarded.
+typedef std::map<size_t, ThreadTimers> EpochTimers;
+static EpochTimers epoch_timers;
+static const size_t max_epochs_kept = 64;
+static size_t first_kept_epoch = 0;
+
+// The times at which the most recent epochs started, by epoch modulo the number
+// kept, as TimerClock ticks; threads split their running timers at these times.
+// Epochs are advanced under the mutex, so the start time of an epoch is stored
+// before any thread can see that epoch.
+static const size_t nr_epoch_starts_kept = 64;
+static std::atomic<TimerClock::rep> epoch_starts[nr_epoch_starts_kept];
+static std::mutex epoch_advance_mutex;
 
 // Each thread first keeps its own set of Timers.
 static thread_local Timer toplevel;
-static thread_local Timer* current_level = nullptr;
+namespace detail {
+thread_local Timer* current_level = nullptr;
+std::atomic<bool> collecting_timers(false);
+std::atomic<size_t> epoch(0);
+thread_local size_t thread_epoch = 0;
+std::atomic<unsigned> settings_generation(0);
+thread_local unsigned thread_settings_generation = 0;
+}
+using detail::current_level;
+using detail::thread_epoch;
+
+// Threads with the same role have their Timers merged in the report.
+static thread_local std::string thread_role;
+
+// In collapsed recursion mode, all running timers of a thread are kept on a
+// stack, innermost last: a tic on a running label re-enters that timer and a
+// toc returns to the timer below it. The time since the last tic or toc is the
+// self time of the innermost timer. A thread only takes over the recursion mode
+// that was set while none of its timers are running.
+static std::atomic<int> recursion_mode(vtRECURSION_NESTED);
+thread_local int detail::thread_recursion_mode = vtRECURSION_NESTED;
+using detail::thread_recursion_mode;
+static thread_local std::vector<Timer*> active_stack;
+static thread_local TimerClock::time_point last_switch;
+
+// Adds the time since the last tic or toc to the self time of the current level.
+static void account_self_time()
+{
+    TimerClock::time_point now = TimerClock::now();
+    detail::current_level->add_self_time(now - last_switch);
+    last_switch = now;
+}
+
+// With a node budget, tics on new labels beyond the budget are redirected to
+// an overflow timer under the current level, so memory stays bounded.
+static std::atomic<size_t> node_budget(0);  // 0: unlimited
+static thread_local size_t nr_nodes = 0;
+static const char* const overflow_label = "(overflow)";
+
+// Samples of the sampling profiler are reported below the sampled timer.
+static const char* const sampled_self_label = "[sampled self]";
+static const char* const sampled_stack_label = "[sampled]";
+
+// Timers of finished threads that are not yet merged into the global set.
+// Threads push onto this list without locking; the reporting thread takes
+// the whole list at once.
+struct CollectedTimer
+{
+    std::thread::id thread_id;
+    std::string role;
+    size_t epoch;
+    Timer timer;
+    CollectedTimer* next;
+};
+
+class CollectedTimers
+{
+public:
+    CollectedTimers() : head_(nullptr) {}
+
+    ~CollectedTimers()
+    {
+        delete_list(take_all());
+    }
+
+    void push(CollectedTimer* collected)
+    {
+        collected->next = head_.load(std::memory_order_relaxed);
+        while (!head_.compare_exchange_weak(collected->next, collected,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed))
+            ;
+    }
+
+    CollectedTimer* take_all()
+    {
+        return head_.exchange(nullptr, std::memory_order_acquire);
+    }
+
+    static void delete_list(CollectedTimer* collected)
+    {
+        while (collected != nullptr)
+        {
+            CollectedTimer* next = collected->next;
+            delete collected;
+            collected = next;
+        }
+    }
+
+private:
+    std::atomic<CollectedTimer*> head_;
+};
+
+static CollectedTimers pending_timers;
+
+static void push_pending_timer(Timer&& timer)
+{
+    CollectedTimer* collected = new CollectedTimer;
+    collected->thread_id = std::this_thread::get_id();
+    collected->role = thread_role;
+    collected->epoch = thread_epoch;
+    collected->timer = std::move(timer);
+    pending_timers.push(collected);
+}
+
+// Starts the next epoch now; returns the epoch that ended.
+static size_t start_next_epoch()
+{
+    std::lock_guard<std::mutex> lock(epoch_advance_mutex);
+
+    size_t ended_epoch = detail::epoch.load(std::memory_order_relaxed);
+    epoch_starts[(ended_epoch + 1) % nr_epoch_starts_kept].store(
+        TimerClock::now().time_since_epoch().count(), std::memory_order_relaxed);
+    detail::epoch.store(ended_epoch + 1, std::memory_order_release);
+    return ended_epoch;
+}
+
+// If the epoch was advanced, the timings of this thread so far are handed over
+// to the global set as those of its epoch, and it continues in the new epoch.
+// Running timers are split at the start of each epoch since, so that the time
+// after an epoch started is not counted in the epoch that ended.
+static void publish_epoch_from_this_thread()
+{
+#ifdef VT_TIMERS_SAMPLER
+    detail::drain_samples_of_this_thread();
+#endif
+    size_t current_epoch = detail::epoch.load(std::memory_order_acquire);
+    if (current_level != nullptr)
+    {
+        if (thread_recursion_mode == vtRECURSION_COLLAPSED)
+            account_self_time();
+
+        // the start times of older epochs are no longer kept, nor are their timings
+        if (current_epoch - thread_epoch >= nr_epoch_starts_kept)
+            thread_epoch = current_epoch - (nr_epoch_starts_kept - 1);
+
+        // not split later than now: with the virtual clock, an epoch may have
+        // started later on the clock of the thread that advanced it
+        TimerClock::time_point now = TimerClock::now();
+        for (; thread_epoch != current_epoch; ++thread_epoch)
+        {
+            TimerClock::time_point start_of_next(TimerClock::duration(
+                epoch_starts[(thread_epoch + 1) % nr_epoch_starts_kept].load(std::memory_order_relaxed)));
+
+            Timer phase;
+            toplevel.split_phase(phase, std::min(start_of_next, now));
+            if (phase.children_count() != 0)
+                push_pending_timer(std::move(phase));
+        }
+    }
+    thread_epoch = current_epoch;
+}
 
-// If a thread is finishing, its Timers are moved to the global set.
+// If a thread is finishing, its Timers are handed over to the global set.
 static void collect_timer_from_this_thread()
 {
-    static std::mutex timers_mutex;
-    std::lock_guard<std::mutex> lock(timers_mutex);
+#ifdef VT_TIMERS_SAMPLER
+    detail::drain_samples_of_this_thread();
+#endif
+    if (!detail::epoch_is_current())
+        publish_epoch_from_this_thread();
     toplevel.stop();
     if (toplevel.children_count() != 0)
-        timers.emplace(std::this_thread::get_id(), std::move(toplevel));
+        push_pending_timer(std::move(toplevel));
     toplevel.reset();
+    nr_nodes = 0;
+    thread_epoch = detail::epoch.load(std::memory_order_relaxed);
+}
+
+// Merges the Timers handed over by finished threads into the global set. Timers
+// of threads with the same role, or with the same (reused) thread id, are merged.
+static void merge_pending_timers()
+{
+    CollectedTimer* pending = pending_timers.take_all();
+    for (CollectedTimer* collected = pending; collected != nullptr; collected = collected->next)
+    {
+        if (collected->epoch < first_kept_epoch)
+            continue;
+
+        ThreadKey key;
+        key.role = collected->role;
+        if (key.role.empty())
+            key.id = collected->thread_id;
+
+        auto& epoch = epoch_timers[collected->epoch];
+        auto existing = epoch.find(key);
+        if (existing == epoch.end())
+            epoch.emplace(key, collected->timer);
+        else
+            existing->second.merge(collected->timer);
+
+        existing = timers.find(key);
+        if (existing == timers.end())
+            timers.emplace(key, std::move(collected->timer));
+        else
+            existing->second.merge(collected->timer);
+    }
+    CollectedTimers::delete_list(pending);
+
+    while (epoch_timers.size() > max_epochs_kept)
+        epoch_timers.erase(epoch_timers.begin());
 }
 
 struct AtThreadExit
 {
     ~AtThreadExit()
     {
+#ifdef VT_TIMERS_SAMPLER
+        detail::stop_sampling_this_thread();
+#endif
         collect_timer_from_this_thread();
     }
 };
@@ -82,51 +326,146 @@ void Timer::reset()
     using namespace std::chrono;
 
     is_running_ = false;
+    budget_ = TimerClock::duration::max();
     children_.clear();
     parent_ = nullptr;
     wall_time_ = duration<double>(0.0);
     cpu_time_ = duration<double>(0.0);
     nr_calls_ = 0;
+    depth_ = 0;
+    nr_samples_.take();
+    details_.reset();
 }
 
 
-void Timer::start()
+Timer::Details& Timer::details()
 {
-    using namespace std::chrono;
+    if (!details_)
+        details_.reset(new Details);
+    return *details_;
+}
 
-    is_running_ = true;
-    start_ = high_resolution_clock::now();
 
-     nr_calls_ += 1;
+void Timer::reenter()
+{
+    nr_calls_ += 1;
+    depth_ += 1;
+    details().max_depth = std::max(details().max_depth, depth_);
 }
 
 
-void Timer::stop()
+void Timer::leave()
 {
-    using namespace std::chrono;
+    depth_ -= 1;
+}
 
-    auto end = high_resolution_clock::now();
-    is_running_ = false;
 
-    wall_time_ += end - start_;
+void Timer::add_self_time(const TimerClock::duration self_time)
+{
+    details().self_time += self_time;
 }
 
 
-bool Timer::is_running() const
+void Timer::add_count(const char* counter, const double value)
 {
-    return is_running_;
+    auto& counts = details().counts;
+    auto count = counts.find(counter);
+    if (count == counts.end())
+        count = counts.emplace(intern_label(counter), 0.0).first;
+    count->second += value;
 }
 
 
-bool Timer::has_timer_with_name(const std::string& name) const
+void Timer::merge(const Timer& other)
 {
-    try {
-        children_.at(name);  // throws if name is not a valid key
+    wall_time_ += other.wall_time_;
+    cpu_time_ += other.cpu_time_;
+    nr_calls_ += other.nr_calls_;
+    nr_samples_.add(other.nr_samples_.load());
+
+    if (other.details_) {
+        const Details& other_details = *other.details_;
+        Details& details = this->details();
+
+        details.max_depth = std::max(details.max_depth, other_details.max_depth);
+        details.self_time += other_details.self_time;
+
+        for (const auto& count : other_details.counts)
+            details.counts[count.first] += count.second;
+
+        for (const auto& stack : other_details.sampled_stacks)
+            details.sampled_stacks[stack.first] += stack.second;
+
+        if (details.folded_labels.size() < other_details.folded_labels.size())
+            details.folded_labels.resize(other_details.folded_labels.size(), 0);
+        for (size_t i = 0; i < other_details.folded_labels.size(); ++i)
+            details.folded_labels[i] |= other_details.folded_labels[i];
     }
-    catch (const std::out_of_range&) {
-        return false;
+
+    for (const auto& child : other.children_)
+        new_or_existing_child(child.first).merge(child.second);
+}
+
+
+void Timer::split_phase(Timer& phase, const TimerClock::time_point now)
+{
+    using namespace std::chrono;
+
+    phase.budget_ = budget_;
+    phase.wall_time_ = wall_time_;
+    phase.cpu_time_ = cpu_time_;
+    phase.nr_calls_ = nr_calls_;
+    phase.nr_samples_.add(nr_samples_.take());
+    phase.details_ = std::move(details_);
+
+    // A running call keeps its start, which stop() also needs for the budget
+    // check, so the part of it in this phase is taken off what stop() adds.
+    // (a timer that started after now has no time in this phase)
+    wall_time_ = duration<double>(0.0);
+    if (is_running_ && now > start_) {
+        phase.wall_time_ += now - start_;
+        wall_time_ -= now - start_;
+    }
+
+    cpu_time_ = duration<double>(0.0);
+    nr_calls_ = 0;
+    details_.reset();
+    if (depth_ > 1)
+        details().max_depth = depth_;
+
+    // timers that were not used in this phase are left out
+    for (auto& child : children_) {
+        Timer& phase_child = phase.children_[child.first];
+        child.second.split_phase(phase_child, now);
+        if (phase_child.nr_calls_ == 0 && phase_child.wall_time_ <= duration<double>(0.0) &&
+                phase_child.nr_samples_.load() == 0 && phase_child.children_.empty())
+            phase.children_.erase(child.first);
     }
-    return true;
+}
+
+
+void Timer::add_sampled_stack(const char* stack)
+{
+    auto& sampled_stacks = details().sampled_stacks;
+    auto sampled = sampled_stacks.find(stack);
+    if (sampled == sampled_stacks.end())
+        sampled = sampled_stacks.emplace(intern_label(stack), 0).first;
+    sampled->second += 1;
+}
+
+
+unsigned long Timer::nr_samples_recursive() const
+{
+    unsigned long nr_samples = nr_samples_.load();
+    for (const auto& child : children_)
+        nr_samples += child.second.nr_samples_recursive();
+    return nr_samples;
+}
+
+
+bool Timer::has_timer_with_name(const char* name) const
+{
+    return children_.find(name) != children_.end();
 }
 
 
@@ -136,10 +475,27 @@ size_t Timer::children_count() const
 }
 
 
-Timer& Timer::new_or_existing_child(const std::string& name)
+bool Timer::has_counts_recursive() const
 {
-    // operator[] creates a new Timer if it does not exist under this name
-    return children_[name];
+    if (details_ && !details_->counts.empty())
+        return true;
+    for (const auto& child : children_)
+        if (child.second.has_counts_recursive())
+            return true;
+    return false;
+}
+
+
+Timer& Timer::new_or_existing_child(const char* name)
+{
+    auto child = children_.find(name);
+    if (child != children_.end())
+        return child->second;
+
+    // a new Timer is keyed by the interned name and gets the budget registered for it
+    Timer& timer = children_[intern_label(name)];
+    timer.budget_ = budget_for(name);
+    return timer;
 }
 
 
@@ -149,20 +505,30 @@ size_t Timer::max_label_length_recursive() const
     for (const auto& child : children_)
     {
         const Timer& timer = child.second;
-        const std::string& name = child.first;
+        const char* name = child.first;
 
-        max_label_length = std::max(max_label_length, name.length());
+        max_label_length = std::max(max_label_length, format_label(name).length());
         max_label_length = std::max(max_label_length, timer.max_label_length_recursive());
+
+        // counters are printed as "[counter]" one level deeper
+        if (timer.details_)
+            for (const auto& count : timer.details_->counts)
+                max_label_length = std::max(max_label_length, std::strlen(count.first) + 2);
+        if (timer.nr_samples_.load() > 0)
+            max_label_length = std::max(max_label_length, std::strlen(sampled_self_label));
     }
     return max_label_length;
 }
 
 
-std::string Timer::tree_string(const std::string& name, const size_t level, const size_t label_length) const
+std::string Timer::tree_string(const std::string& name, const size_t level, const size_t label_length,
+                               const bool per_thread_rates) const
 {
     std::stringstream out;
 
-    if ( nr_calls_ == 0 && children_.size() == 0)
+    // timers of an epoch may have run without being called in it
+    if ( nr_calls_ == 0 && wall_time_ <= std::chrono::duration<double>(0.0) && nr_samples_.load() == 0 &&
+            children_.size() == 0)
         return out.str();
 
     // print own timings
@@ -171,32 +537,94 @@ std::string Timer::tree_string(const std::string& name, const size_t level, cons
     nr_calls_ss << "(" << nr_calls_ << ")";
     out << indent << std::setw(label_length) << std::left << name
         << "  " << std::setw(8) << wall_time_.count() * 1000.0
-        << std::setw(7) << nr_calls_ss.str() << "\n";
+        << std::setw(7) << nr_calls_ss.str();
 
-    // copy children into vector, since vector has a random access iterator that will be used by std::sort
-    typedef std::pair<std::string, Timer> TimerLabelPair;
-    std::vector<TimerLabelPair> children(children_.begin(), children_.end());
+    static const Details no_details;
+    const Details& details = details_ ? *details_ : no_details;
+
+    // recursive timers also report their self time and recursion depth; the
+    // depth of overflow timers is that of the tics folded into them
+    if (details.max_depth > 1 && details.folded_labels.empty()) {
+        out << "  self " << details.self_time.count() * 1000.0
+            << ", max depth " << details.max_depth;
+    }
+
+    // overflow timers report how many distinct labels were folded into them
+    if (!details.folded_labels.empty())
+        out << "  folded ~" << static_cast<unsigned long>(folded_labels_count() + 0.5) << " labels";
+    out << "\n";
+
+    // print work counters and the throughput derived from them
+    const char* rate_suffix = per_thread_rates ? " per thread" : "";
+    for (const auto& count : details.counts) {
+        const std::string counter = count.first;
+        const double value = count.second;
+        const double seconds = wall_time_.count();
+
+        out << std::string(level + 3, ' ') << std::setw(label_length) << std::left
+            << "[" + counter + "]" << "  " << std::setw(8) << value;
+        if (seconds > 0.0 && value > 0.0) {
+            if (counter == "bytes")
+                out << "  " << value / seconds * 1e-9 << " GB/s" << rate_suffix;
+            else
+                out << "  " << value / seconds << " " << counter << "/s" << rate_suffix;
+            out << ", " << seconds * 1e9 / value << " ns/" << counter;
+        }
+        out << "\n";
+    }
+
+    // print the self time estimated from the samples, broken down by sampled call stack
+    const unsigned long nr_samples = nr_samples_.load();
+    if (nr_samples > 0) {
+        const double self_milliseconds = wall_time_.count() * 1000.0 * static_cast<double>(nr_samples) /
+                                         static_cast<double>(nr_samples_recursive());
+        out << std::string(level + 3, ' ') << std::setw(label_length) << std::left
+            << sampled_self_label << "  " << std::setw(8) << self_milliseconds
+            << "  " << nr_samples << " samples\n";
+
+        typedef std::pair<const char*, unsigned long> StackCountPair;
+        std::vector<StackCountPair> stacks(details.sampled_stacks.begin(), details.sampled_stacks.end());
+        auto most_first = [](const StackCountPair& a, const StackCountPair& b)
+        {
+            return a.second > b.second;
+        };
+        std::sort(stacks.begin(), stacks.end(), most_first);
+
+        for (const auto& stack : stacks) {
+            const double fraction = static_cast<double>(stack.second) / static_cast<double>(nr_samples);
+            out << std::string(level + 6, ' ') << std::setw(label_length) << std::left
+                << sampled_stack_label << "  " << std::setw(8) << self_milliseconds * fraction
+                << "  " << std::setw(4) << std::right << static_cast<int>(fraction * 100.0 + 0.5)
+                << std::left << "%  " << stack.first << "\n";
+        }
+    }
+
+    // collect the children in a vector, since vector has a random access iterator that will be used by std::sort
+    typedef std::pair<const char*, const Timer*> TimerLabelPair;
+    std::vector<TimerLabelPair> children;
+    for (const auto& child : children_)
+        children.emplace_back(child.first, &child.second);
 
     // sort the children
     auto longest_first = [](const TimerLabelPair& a,
                             const TimerLabelPair& b)
     {
-        return a.second.wall_time_ > b.second.wall_time_;
+        return a.second->wall_time_ > b.second->wall_time_;
     };
     std::sort(children.begin(), children.end(), longest_first);
 
     // print children's timings
     for (const auto& child : children) {
-        const Timer& timer = child.second;
-        const std::string& name = child.first;
-        out << timer.tree_string(name, level + 3, label_length);
+        const Timer& timer = *child.second;
+        const char* name = child.first;
+        out << timer.tree_string(format_label(name), level + 3, label_length, per_thread_rates);
     }
 
     // print remaining time
     if (children.size() > 0) {
         std::chrono::duration<double> children_time(0.0);
         for (const auto& child : children) {
-            const Timer& timer = child.second;
+            const Timer& timer = *child.second;
             children_time += timer.wall_time_;
         }
         std::chrono::duration<double> other_time = wall_time_ - children_time;
@@ -214,12 +642,91 @@ std::string Timer::tree_string(const std::string& name, const size_t level, cons
 }
 
 
+static std::atomic<LabelFormatter> label_formatter(nullptr);
+
+
+VT_TIMERS_ATTR void set_label_formatter(LabelFormatter formatter)
+{
+    label_formatter.store(formatter);
+}
+
+
+VT_TIMERS_ATTR std::string format_label(const char* label)
+{
+    LabelFormatter formatter = label_formatter.load();
+    return formatter == nullptr ? std::string(label) : formatter(label);
+}
+
+
+// Names of the threads and formatted labels as shown in the reports, stored
+// until the next reset so that the query functions can hand them out.
+static std::set<std::string> report_names;
+
+// The Timers of the threads, ordered by the names of the threads: their role,
+// or "Main thread" for the thread that reports, or their id.
+static std::vector<std::pair<const char*, const Timer*>> named_thread_timers(const ThreadTimers& thread_timers)
+{
+    std::thread::id main_thread_id = std::this_thread::get_id();
+
+    std::vector<std::pair<const char*, const Timer*>> named_timers;
+    for (const auto& key_and_timer : thread_timers)
+    {
+        const ThreadKey& key = key_and_timer.first;
+        std::string name = key.role;
+        if (name.empty())
+        {
+            std::stringstream ss;
+            if (key.id == main_thread_id)
+                ss << "Main thread";
+            else
+                ss << "thread id " << key.id;
+            name = ss.str();
+        }
+        named_timers.emplace_back(report_names.insert(name).first->c_str(), &key_and_timer.second);
+    }
+
+    auto by_name = [](const std::pair<const char*, const Timer*>& a, const std::pair<const char*, const Timer*>& b)
+    {
+        return std::strcmp(a.first, b.first) < 0;
+    };
+    std::stable_sort(named_timers.begin(), named_timers.end(), by_name);
+    return named_timers;
+}
+
+
+static void thread_timers_to_stream(std::ostream& out, const ThreadTimers& thread_timers)
+{
+    auto tree_string = [](const Timer& timer, const std::string& name, const bool per_thread_rates)
+    {
+        size_t min_label_length = 10;
+        size_t max_label_length = std::max(name.size(), timer.max_label_length_recursive());
+        size_t label_length = std::max(min_label_length, max_label_length);
+        return timer.tree_string(name, 0, label_length, per_thread_rates);
+    };
+
+    for (const auto& name_and_timer : named_thread_timers(thread_timers))
+        out << tree_string(*name_and_timer.second, name_and_timer.first, false);
+
+    // Counts of all threads together; the times are summed over the threads,
+    // so the rates are those per thread
+    if (thread_timers.size() > 1)
+    {
+        Timer merged;
+        for (const auto& key_and_timer : thread_timers)
+            merged.merge(key_and_timer.second);
+        if (merged.has_counts_recursive())
+            out << tree_string(merged, "All threads", true);
+    }
+}
+
+
 static void timers_collect()
 {
     // Retrieve timers from main thread, also for sequential code
     collect_timer_from_this_thread();
 
     // Retrieve timers from OpenMP threads
+    detail::collecting_timers.store(true);
     #pragma omp parallel for
     for (int i = 0; i < omp_get_max_threads(); ++i)
     {
@@ -230,6 +737,9 @@ static void timers_collect()
         collect_timer_from_this_thread();
     }
     #pragma omp barrier  // necessary?
+    detail::collecting_timers.store(false);
+
+    merge_pending_timers();
 }
 
 
@@ -238,6 +748,9 @@ VT_TIMERS_ATTR void timers_to_stream(std::ostream& out)
     if (current_level != &toplevel && current_level != nullptr)
         throw std::runtime_error("Not all timers have been stopped!");
 
+    std::lock_guard<std::mutex> lock(timers_mutex);
+    merge_pending_timers();
+
     if (current_level == nullptr && timers.size() == 0)
     {
         out << "No timings to report.\n";
@@ -250,32 +763,30 @@ VT_TIMERS_ATTR void timers_to_stream(std::ostream& out)
 
     out << "Timing report: \n";
 
-    std::thread::id main_thread_id = std::this_thread::get_id();
     // All timers should be in static timers map
-    for (auto id_and_timer = timers.begin();
-         id_and_timer != timers.end();
-         ++id_and_timer)
-    {
-        std::thread::id tid = id_and_timer->first;
-        std::string thread_id;
-        if (tid == main_thread_id)
-        {
-            thread_id = "Main thread";
-        }
-        else
-        {
-            std::stringstream ss;
-            ss << "thread id " << tid;
-            thread_id = ss.str();
-        }
+    thread_timers_to_stream(out, timers);
+}
 
-        const Timer& timer = id_and_timer->second;
-        size_t min_label_length = 10;
-        size_t max_label_length = std::max(thread_id.size(), timer.max_label_length_recursive());
-        size_t label_length = std::max(min_label_length, max_label_length);
 
-        out << timer.tree_string(thread_id, 0, label_length);
+VT_TIMERS_ATTR void timers_epoch_to_stream(std::ostream& out, const size_t epoch)
+{
+    std::lock_guard<std::mutex> lock(timers_mutex);
+    merge_pending_timers();
+
+    auto epoch_and_timers = epoch_timers.find(epoch);
+    if (epoch_and_timers == epoch_timers.end())
+    {
+        out << "No timings to report for epoch " << epoch << ".\n";
+        return;
     }
+
+    const auto& epoch_timers = epoch_and_timers->second;
+    out << "Collected timer info of epoch " << epoch << " from " << epoch_timers.size()
+        << " thread" << (epoch_timers.size() == 1 ? "" : "s") << "\n";
+
+    out << "Timing report: \n";
+
+    thread_timers_to_stream(out, epoch_timers);
 }
 
 
@@ -287,17 +798,241 @@ VT_TIMERS_ATTR std::string timers_to_string()
 }
 
 
+VT_TIMERS_ATTR std::string timers_epoch_to_string(const size_t epoch)
+{
+    std::stringstream out;
+    timers_epoch_to_stream(out, epoch);
+    return out.str();
+}
+
+
+// The label of a timer as shown in the reports, see format_label.
+static const char* shown_label(const char* label)
+{
+    if (label_formatter.load() == nullptr)
+        return label;
+
+    const std::string formatted = format_label(label);
+    if (formatted == label)
+        return label;
+    return report_names.insert(formatted).first->c_str();
+}
+
+
+static void visit_timer_node(const char* thread, const char* label, const Timer& timer, const size_t parent,
+                             std::vector<const char*>& path, size_t& index, const TimerVisitor& visitor)
+{
+    // like in the report, timers that were not used are left out
+    if (timer.nr_calls() == 0 && timer.wall_time() <= std::chrono::duration<double>(0.0) &&
+            timer.nr_samples() == 0 && timer.children().empty())
+        return;
+
+    vtTimerNode node;
+    node.thread = thread;
+    node.label = label;
+    node.path = path.data();
+    node.index = index++;
+    node.parent = parent;
+    node.depth = static_cast<unsigned>(path.size());
+    node.nr_calls = timer.nr_calls();
+    node.wall_time = timer.wall_time().count();
+    node.nr_samples = timer.nr_samples();
+    visitor(node);
+
+    // the children are visited in the order of the labels shown for them
+    typedef std::pair<const char*, const Timer*> TimerLabelPair;
+    std::vector<TimerLabelPair> children;
+    for (const auto& child : timer.children())
+        children.emplace_back(shown_label(child.first), &child.second);
+    auto by_label = [](const TimerLabelPair& a, const TimerLabelPair& b)
+    {
+        return std::strcmp(a.first, b.first) < 0;
+    };
+    std::stable_sort(children.begin(), children.end(), by_label);
+
+    for (const auto& child : children) {
+        path.push_back(child.first);
+        visit_timer_node(thread, child.first, *child.second, node.index, path, index, visitor);
+        path.pop_back();
+    }
+}
+
+
+VT_TIMERS_ATTR void visit_timers(const TimerVisitor& visitor)
+{
+    if (current_level != &toplevel && current_level != nullptr)
+        throw std::runtime_error("Not all timers have been stopped!");
+
+    std::lock_guard<std::mutex> lock(timers_mutex);
+    timers_collect();
+
+    std::vector<const char*> path;
+    size_t index = 0;
+    for (const auto& name_and_timer : named_thread_timers(timers)) {
+        const char* thread = name_and_timer.first;
+        visit_timer_node(thread, thread, *name_and_timer.second, SIZE_MAX, path, index, visitor);
+    }
+}
+
+
+VT_TIMERS_ATTR std::vector<vtTimerNode> timer_nodes()
+{
+    std::vector<vtTimerNode> nodes;
+    visit_timers([&nodes](const vtTimerNode& node)
+    {
+        nodes.push_back(node);
+        nodes.back().path = nullptr;
+    });
+    return nodes;
+}
+
+
+VT_TIMERS_ATTR bool find_timer(const char* thread, const char* path, vtTimerNode& node)
+{
+    std::vector<std::string> labels;
+    std::stringstream ss(path);
+    std::string label;
+    while (std::getline(ss, label, '/'))
+        labels.push_back(label);
+
+    bool found = false;
+    visit_timers([&](const vtTimerNode& candidate)
+    {
+        if (candidate.depth != labels.size() || candidate.depth == 0 ||
+                (thread != nullptr && std::strcmp(thread, candidate.thread) != 0))
+            return;
+        for (size_t i = 0; i < labels.size(); ++i)
+            if (labels[i] != candidate.path[i])
+                return;
+
+        if (!found) {
+            node = candidate;
+            node.path = nullptr;
+            found = true;
+        }
+        else {
+            node.nr_calls += candidate.nr_calls;
+            node.wall_time += candidate.wall_time;
+            node.nr_samples += candidate.nr_samples;
+        }
+    });
+    return found;
+}
+
+
+VT_TIMERS_ATTR size_t advance_timer_epoch()
+{
+    size_t ended_epoch = start_next_epoch();
+    publish_epoch_from_this_thread();
+    return ended_epoch;
+}
+
+
 }  // namespace vt
 
 
 
-VT_C_API vtErrorCode VT_C_CALLCONV vt_timer_tic(const char* name) VT_EXCEPT_TO_ERRORCODE(
+namespace vt {
+
+// Returns the running timer with the given name on this thread's stack of
+// running timers (collapsed recursion mode), if any.
+static Timer* running_timer_with_name(const char* name)
 {
-    using namespace vt;
+    for (auto timer = active_stack.rbegin(); timer != active_stack.rend(); ++timer)
+        if ((*timer)->parent_->find_child(name) == *timer)
+            return *timer;
+
+    return nullptr;
+}
+
+
+
+static bool is_overflow(Timer* timer)
+{
+    return timer->parent_ != nullptr && timer->parent_->find_child(overflow_label) == timer;
+}
+
+
+// Applies the settings that changed since this thread last did: if a budget was
+// set, the budgets cached in its timers are looked up again, so that stop() only
+// needs to compare with its own budget, and the thread is sampled if the sampler
+// was started. A new recursion mode is only taken over while none of the timers
+// of the thread are running; until then, the settings stay marked as changed.
+static void apply_settings_if_changed()
+{
+    unsigned generation = detail::settings_generation.load(std::memory_order_acquire);
+    if (detail::thread_settings_generation != generation) {
+        const int mode = recursion_mode.load(std::memory_order_relaxed);
+        if (current_level == nullptr || current_level == &toplevel) {
+            if (thread_recursion_mode != mode)
+                last_switch = TimerClock::now();
+            thread_recursion_mode = mode;
+        }
+        if (thread_recursion_mode == mode)
+            detail::thread_settings_generation = generation;
+
+        detail::refresh_budgets_if_changed(toplevel);
+#ifdef VT_TIMERS_SAMPLER
+        detail::sample_this_thread_if_enabled();
+#endif
+    }
+}
+
+
+// The first tic of a thread (after a reset) starts its top level timer.
+static void start_toplevel()
+{
+    current_level = &toplevel;
+    toplevel.start();
+    last_switch = TimerClock::now();
+}
+
+
+VT_TIMERS_ATTR vtErrorCode detail::timer_tic_slow(const char* name) VT_EXCEPT_TO_ERRORCODE(
+{
+    if (name == nullptr)
+        throw std::runtime_error("Timer name should not be NULL!");
+
+    if (!epoch_is_current())
+        publish_epoch_from_this_thread();
+    apply_settings_if_changed();
 
     if (current_level == nullptr) {
-        current_level = &toplevel;
-        toplevel.start();
+        start_toplevel();
+    }
+
+    const bool collapsed = thread_recursion_mode == vtRECURSION_COLLAPSED;
+    if (collapsed) {
+        account_self_time();
+        Timer* running = running_timer_with_name(name);
+        if (running != nullptr) {
+            active_stack.push_back(running);
+            current_level = running;
+            running->reenter();
+            return vtOK;
+        }
+    }
+
+    // Tics below an overflow timer are folded into it as re-entries, so that
+    // overflow timers are never nested.
+    if (is_overflow(current_level)) {
+        current_level->fold(name);
+        current_level->reenter();
+        if (collapsed)
+            active_stack.push_back(current_level);
+        return vtOK;
+    }
+
+    if (!current_level->has_timer_with_name(name)) {
+        size_t budget = node_budget.load(std::memory_order_relaxed);
+        if (budget != 0 && nr_nodes >= budget) {
+            Timer& overflow = current_level->new_or_existing_child(overflow_label);
+            overflow.fold(name);
+            name = overflow_label;
+        }
+        else {
+            ++nr_nodes;
+        }
     }
 
     Timer& timer = current_level->new_or_existing_child(name);
@@ -306,6 +1041,8 @@ VT_C_API vtErrorCode VT_C_CALLCONV vt_timer_tic(const char* name) VT_EXCEPT_TO_E
 
     timer.parent_ = current_level;
     current_level = &timer;
+    if (collapsed)
+        active_stack.push_back(&timer);
 
     timer.start();
 
@@ -313,9 +1050,14 @@ VT_C_API vtErrorCode VT_C_CALLCONV vt_timer_tic(const char* name) VT_EXCEPT_TO_E
 })
 
 
-VT_C_API vtErrorCode VT_C_CALLCONV vt_timer_toc(const char* name) VT_EXCEPT_TO_ERRORCODE(
+VT_TIMERS_ATTR vtErrorCode detail::timer_toc_slow(const char* name) VT_EXCEPT_TO_ERRORCODE(
 {
-    using namespace vt;
+    if (name == nullptr)
+        throw std::runtime_error("Timer name should not be NULL!");
+
+    if (!epoch_is_current())
+        publish_epoch_from_this_thread();
+    apply_settings_if_changed();
 
     if (current_level == nullptr) {
         throw std::runtime_error("No started timers available!");
@@ -324,7 +1066,7 @@ VT_C_API vtErrorCode VT_C_CALLCONV vt_timer_toc(const char* name) VT_EXCEPT_TO_E
     bool check_name = true;
     if (check_name) {
         if (current_level->parent_ == nullptr ||
-                ! current_level->parent_->has_timer_with_name(name)) {
+                (! current_level->parent_->has_timer_with_name(name) && !is_overflow(current_level))) {
             std::stringstream ss;
             ss << "Timer with name '" << name << "' does not exist, so cannot be stopped!";
             throw std::runtime_error(ss.str());
@@ -332,6 +1074,23 @@ VT_C_API vtErrorCode VT_C_CALLCONV vt_timer_toc(const char* name) VT_EXCEPT_TO_E
     }
 
     Timer* timer = current_level;
+    if (thread_recursion_mode == vtRECURSION_COLLAPSED) {
+        account_self_time();
+        if (timer->depth() > 1)
+            timer->leave();
+        else
+            timer->stop();
+        active_stack.pop_back();
+        current_level = active_stack.empty() ? &toplevel : active_stack.back();
+        return vtOK;
+    }
+
+    // leaving a tic that was folded into an overflow timer
+    if (timer->depth() > 1) {
+        timer->leave();
+        return vtOK;
+    }
+
     timer->stop();
 
     current_level = current_level->parent_;
@@ -339,6 +1098,52 @@ VT_C_API vtErrorCode VT_C_CALLCONV vt_timer_toc(const char* name) VT_EXCEPT_TO_E
     return vtOK;
 })
 
+}  // namespace vt
+
+
+VT_C_API vtErrorCode VT_C_CALLCONV vt_timer_tic(const char* name) VT_EXCEPT_TO_ERRORCODE(
+{
+    return vt::timer_tic(name);
+})
+
+
+VT_C_API vtErrorCode VT_C_CALLCONV vt_timer_toc(const char* name) VT_EXCEPT_TO_ERRORCODE(
+{
+    return vt::timer_toc(name);
+})
+
+
+VT_C_API vtErrorCode VT_C_CALLCONV vt_timer_set_thread_role(const char* role) VT_EXCEPT_TO_ERRORCODE(
+{
+    using namespace vt;
+
+    if (role == nullptr)
+        throw std::runtime_error("Thread role should not be NULL!");
+
+    thread_role = role;
+
+    return vtOK;
+})
+
+
+VT_C_API vtErrorCode VT_C_CALLCONV vt_timer_count(const char* counter, const double value) VT_EXCEPT_TO_ERRORCODE(
+{
+    using namespace vt;
+
+    if (counter == nullptr)
+        throw std::runtime_error("Counter name should not be NULL!");
+    if (current_level == nullptr || current_level == &toplevel) {
+        throw std::runtime_error("No started timers available!");
+    }
+
+    if (!detail::epoch_is_current())
+        publish_epoch_from_this_thread();
+
+    current_level->add_count(counter, value);
+
+    return vtOK;
+})
+
 
 VT_C_API vtErrorCode VT_C_CALLCONV vt_timers_to_cstring(char* cstring, const size_t n) VT_EXCEPT_TO_ERRORCODE(
 {
@@ -367,9 +1172,123 @@ VT_C_API vtErrorCode VT_C_CALLCONV vt_timers_reset() VT_EXCEPT_TO_ERRORCODE(
 {
     using namespace vt;
 
+    std::lock_guard<std::mutex> lock(timers_mutex);
     timers_collect();
     timers.clear();
+    report_names.clear();
     current_level = nullptr;
+    active_stack.clear();
+    nr_nodes = 0;
+
+    // Other threads may still be timing: they publish their timings at their
+    // next tic or toc, as those of an epoch before the reset, which are discarded.
+    epoch_timers.clear();
+    first_kept_epoch = start_next_epoch() + 1;
+    thread_epoch = first_kept_epoch;
+
+    return vtOK;
+})
+
+
+VT_C_API vtErrorCode VT_C_CALLCONV vt_timers_visit(vtTimerVisitor visitor, void* user_data) VT_EXCEPT_TO_ERRORCODE(
+{
+    using namespace vt;
+
+    visit_timers([&](const vtTimerNode& node)
+    {
+        visitor(&node, user_data);
+    });
+
+    return vtOK;
+})
+
+
+VT_C_API vtErrorCode VT_C_CALLCONV vt_timers_get_nodes(vtTimerNode* nodes, const size_t capacity, size_t* nr_nodes) VT_EXCEPT_TO_ERRORCODE(
+{
+    using namespace vt;
+
+    size_t count = 0;
+    visit_timers([&](const vtTimerNode& node)
+    {
+        if (count < capacity) {
+            nodes[count] = node;
+            nodes[count].path = nullptr;
+        }
+        ++count;
+    });
+    if (nr_nodes != nullptr)
+        *nr_nodes = count;
+
+    return count > capacity ? vtWARNING : vtOK;
+})
+
+
+VT_C_API vtErrorCode VT_C_CALLCONV vt_timers_find(const char* thread, const char* path, vtTimerNode* node) VT_EXCEPT_TO_ERRORCODE(
+{
+    using namespace vt;
+
+    if (path == nullptr || node == nullptr)
+        throw std::runtime_error("No path or node given!");
+
+    return find_timer(thread, path, *node) ? vtOK : vtWARNING;
+})
+
+
+VT_C_API vtErrorCode VT_C_CALLCONV vt_timers_advance_epoch(size_t* ended_epoch) VT_EXCEPT_TO_ERRORCODE(
+{
+    using namespace vt;
+
+    size_t epoch = advance_timer_epoch();
+    if (ended_epoch != nullptr)
+        *ended_epoch = epoch;
+
+    return vtOK;
+})
+
+
+VT_C_API vtErrorCode VT_C_CALLCONV vt_timers_epoch_to_cstring(const size_t epoch, char* cstring, const size_t n) VT_EXCEPT_TO_ERRORCODE(
+{
+    using namespace vt;
+
+    std::stringstream out;
+    timers_epoch_to_stream(out, epoch);
+    strncpy(cstring, out.str().c_str(), n - 1);
+    cstring[n - 1] = '\0';
+
+    return vtOK;
+})
+
+
+VT_C_API vtErrorCode VT_C_CALLCONV vt_timers_epoch_to_stdout(const size_t epoch) VT_EXCEPT_TO_ERRORCODE(
+{
+    using namespace vt;
+
+    timers_epoch_to_stream(std::cout, epoch);
+
+    return vtOK;
+})
+
+
+VT_C_API vtErrorCode VT_C_CALLCONV vt_timers_set_node_budget(const size_t max_nodes_per_thread) VT_EXCEPT_TO_ERRORCODE(
+{
+    using namespace vt;
+
+    node_budget.store(max_nodes_per_thread, std::memory_order_relaxed);
+
+    return vtOK;
+})
+
+
+VT_C_API vtErrorCode VT_C_CALLCONV vt_timers_set_recursion_mode(vtRecursionMode mode) VT_EXCEPT_TO_ERRORCODE(
+{
+    using namespace vt;
+
+    if (mode != vtRECURSION_NESTED && mode != vtRECURSION_COLLAPSED)
+        throw std::runtime_error("Unknown recursion mode!");
+
+    // each thread takes the mode over in the slow path, once it is not timing
+    recursion_mode.store(mode, std::memory_order_relaxed);
+    detail::settings_generation.fetch_add(1, std::memory_order_release);
 
     return vtOK;
 })
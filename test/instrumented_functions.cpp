@@ -0,0 +1,58 @@
+// Copyright (c) 2019-2020 VORtech b.v.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Functions for test_instrument.cpp. Only this file is compiled with
+// -finstrument-functions.
+
+// in test_instrument.cpp, so that the inline std::chrono functions are not
+// instrumented
+double now_in_milliseconds();
+
+
+void busy_wait(const double milliseconds)
+{
+    const double t0 = now_in_milliseconds();
+    while (now_in_milliseconds() - t0 < milliseconds)
+        ;
+}
+
+namespace solver {
+
+__attribute__((noinline)) void assemble()
+{
+    busy_wait(1.0);
+}
+
+__attribute__((noinline)) void compute(const int iterations)
+{
+    for (int i = 0; i < iterations; ++i)
+        busy_wait(0.5);
+}
+
+}  // namespace solver
+
+__attribute__((noinline)) void solve(const int nr_steps)
+{
+    for (int step = 0; step < nr_steps; ++step)
+    {
+        solver::assemble();
+        solver::compute(2);
+    }
+}
@@ -0,0 +1,129 @@
+// Copyright (c) 2019-2020 VORtech b.v.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <vt/instrument.h>
+#include <vt/timers.hpp>
+#include <vt/timers.h>
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+// in instrumented_functions.cpp
+void solve(const int nr_steps);
+
+
+double now_in_milliseconds()
+{
+    using namespace std::chrono;
+    return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+
+TEST(InstrumentTest, FunctionTree)
+{
+    std::string report;
+    ASSERT_NO_THROW(
+    {
+        vt_timer_tic("manual region");
+            solve(3);
+        vt_timer_toc("manual region");
+
+        report = vt::timers_to_string();
+    });
+    std::cout << report;
+
+    size_t manual = report.find("manual region");
+    size_t solve = report.find("solve(int)", manual);
+    size_t assemble = report.find("solver::assemble()", solve);
+    size_t compute = report.find("solver::compute(int)", solve);
+    ASSERT_NE(manual, std::string::npos);
+    EXPECT_NE(solve, std::string::npos);
+    EXPECT_NE(assemble, std::string::npos);
+    EXPECT_NE(compute, std::string::npos);
+    EXPECT_EQ(report.find("fn@"), std::string::npos);
+
+    vt_timers_reset();
+}
+
+TEST(InstrumentTest, Queries)
+{
+    ASSERT_NO_THROW(
+    {
+        solve(2);
+    });
+
+    vtTimerNode node;
+    EXPECT_EQ(vt_timers_find(nullptr, "solve(int)/solver::compute(int)", &node), vtOK);
+    EXPECT_EQ(node.nr_calls, 2u);
+    EXPECT_STREQ(node.label, "solver::compute(int)");
+    EXPECT_EQ(vt_timers_find(nullptr, "solve(int)/solver::assemble()/busy_wait(double)", &node), vtOK);
+    EXPECT_EQ(node.nr_calls, 2u);
+
+    for (const auto& timer_node : vt::timer_nodes())
+        EXPECT_NE(std::string(timer_node.label).find("fn@"), 0u);
+
+    vt_timers_reset();
+}
+
+TEST(InstrumentTest, Filter)
+{
+    std::string report;
+    ASSERT_NO_THROW(
+    {
+        EXPECT_EQ(vt_instrument_set_filter("solve", "assemble"), vtOK);
+        solve(1);
+        report = vt::timers_to_string();
+        EXPECT_EQ(vt_instrument_set_filter(nullptr, nullptr), vtOK);
+    });
+    std::cout << report;
+
+    EXPECT_NE(report.find("solve(int)"), std::string::npos);
+    EXPECT_NE(report.find("solver::compute(int)"), std::string::npos);
+    EXPECT_EQ(report.find("assemble"), std::string::npos);
+    EXPECT_EQ(report.find("busy_wait"), std::string::npos);
+
+    vt_timers_reset();
+}
+
+TEST(InstrumentTest, MinDuration)
+{
+    std::string report;
+    ASSERT_NO_THROW(
+    {
+        EXPECT_EQ(vt_instrument_set_min_duration(-1.0), vtERROR);
+        EXPECT_EQ(vt_instrument_set_min_duration(0.1), vtOK);
+        solve(70);  // busy_wait is called 140 times from compute
+        report = vt::timers_to_string();
+        EXPECT_EQ(vt_instrument_set_min_duration(0.0), vtOK);
+    });
+    std::cout << report;
+
+    // busy_wait in compute is not timed anymore after 100 calls of 0.5 ms
+    const std::string busy_wait_label("busy_wait(double)");
+    size_t busy_wait = report.find(busy_wait_label, report.find("solver::compute(int)"));
+    ASSERT_NE(busy_wait, std::string::npos);
+    busy_wait += busy_wait_label.size();
+    EXPECT_EQ(report.find("(100)", busy_wait), report.find("(", busy_wait));
+
+    vt_timers_reset();
+}
@@ -24,15 +24,26 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <sstream>
 #include <thread>
+#include <vector>
 #include <chrono>
 
 #include <omp.h>
+#ifdef VT_TIMERS_OMPT
+#include <cstdlib>
+#include <dlfcn.h>
+#endif
 
 
 void sleep(const double milliseconds)
 {
+#ifdef VT_TIMERS_VIRTUAL_CLOCK
+    vt_virtual_clock_advance(milliseconds / 1000.0);
+#else
     using namespace std::chrono;
     auto t0 = high_resolution_clock::now();
     duration<double> duration(0.0);
@@ -41,6 +52,7 @@ void sleep(const double milliseconds)
 
 //     //ALTERNATIVE:
 //     std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(milliseconds));
+#endif
 }
 
 
@@ -249,6 +261,405 @@ TEST(TimersTest, FailNotNested)
     vt_timers_reset();
 }
 
+TEST(TimersTest, FailNullNames)
+{
+    ASSERT_NO_THROW(
+    {
+        EXPECT_EQ(vt_timer_tic(nullptr), vtERROR);
+        EXPECT_EQ(vt_timer_toc(nullptr), vtERROR);
+
+        EXPECT_EQ(vt_timer_tic("label1"), vtOK);
+            EXPECT_EQ(vt_timer_tic(nullptr), vtERROR);
+            EXPECT_EQ(vt_timer_count(nullptr, 1.0), vtERROR);
+        EXPECT_EQ(vt_timer_toc(nullptr), vtERROR);
+        EXPECT_EQ(vt_timer_toc("label1"), vtOK);
+
+        EXPECT_EQ(vt_timer_set_thread_role(nullptr), vtERROR);
+    });
+
+    vt_timers_reset();
+}
+
+static void recurse(const int depth)
+{
+    vt_timer_tic("recurse");
+        sleep(1.0);
+        if (depth > 1)
+            recurse(depth - 1);
+    vt_timer_toc("recurse");
+}
+
+static size_t count_occurrences(const std::string& text, const std::string& word)
+{
+    size_t count = 0;
+    for (size_t pos = text.find(word); pos != std::string::npos; pos = text.find(word, pos + 1))
+        ++count;
+    return count;
+}
+
+TEST(TimersTest, CollapsedRecursion)
+{
+    std::string report;
+    ASSERT_NO_THROW(
+    {
+        EXPECT_EQ(vt_timers_set_recursion_mode(vtRECURSION_COLLAPSED), vtOK);
+
+        vt_timer_tic("solve");
+            recurse(5);
+            recurse(3);
+        vt_timer_toc("solve");
+
+        report = vt::timers_to_string();
+    });
+    std::cout << report;
+
+    EXPECT_EQ(count_occurrences(report, "recurse"), 1u);
+    EXPECT_EQ(count_occurrences(report, "(8)"), 1u);
+    EXPECT_EQ(count_occurrences(report, "max depth 5"), 1u);
+
+    vt_timers_reset();
+    vt_timers_set_recursion_mode(vtRECURSION_NESTED);
+}
+
+TEST(TimersTest, CollapsedMutualRecursion)
+{
+    std::string report;
+    ASSERT_NO_THROW(
+    {
+        vt_timers_set_recursion_mode(vtRECURSION_COLLAPSED);
+
+        for (int i = 0; i < 3; ++i)
+        {
+            EXPECT_EQ(vt_timer_tic("even"), vtOK);
+                EXPECT_EQ(vt_timer_tic("odd"), vtOK);
+                    EXPECT_EQ(vt_timer_tic("even"), vtOK);
+                        EXPECT_EQ(vt_timer_tic("odd"), vtOK);
+                            sleep(1.0);
+                        EXPECT_EQ(vt_timer_toc("odd"), vtOK);
+                    EXPECT_EQ(vt_timer_toc("even"), vtOK);
+                EXPECT_EQ(vt_timer_toc("odd"), vtOK);
+            EXPECT_EQ(vt_timer_toc("even"), vtOK);
+        }
+
+        report = vt::timers_to_string();
+    });
+    std::cout << report;
+
+    EXPECT_EQ(count_occurrences(report, "even"), 1u);
+    EXPECT_EQ(count_occurrences(report, "odd"), 1u);
+    EXPECT_EQ(count_occurrences(report, "max depth 2"), 2u);
+
+    vt_timers_reset();
+    vt_timers_set_recursion_mode(vtRECURSION_NESTED);
+}
+
+TEST(TimersTest, CollapsedReentryOfOuterTimer)
+{
+    std::string report;
+    ASSERT_NO_THROW(
+    {
+        vt_timers_set_recursion_mode(vtRECURSION_COLLAPSED);
+
+        EXPECT_EQ(vt_timer_tic("alpha"), vtOK);
+            sleep(1.0);
+            EXPECT_EQ(vt_timer_tic("beta"), vtOK);
+                sleep(1.0);
+                EXPECT_EQ(vt_timer_tic("gamma"), vtOK);
+                    sleep(1.0);
+                    EXPECT_EQ(vt_timer_tic("alpha"), vtOK);
+                        sleep(1.0);
+                        EXPECT_EQ(vt_timer_tic("gamma"), vtOK);
+                            sleep(1.0);
+                        EXPECT_EQ(vt_timer_toc("gamma"), vtOK);
+                    EXPECT_EQ(vt_timer_toc("alpha"), vtOK);
+                EXPECT_EQ(vt_timer_toc("gamma"), vtOK);
+            EXPECT_EQ(vt_timer_toc("beta"), vtOK);
+        EXPECT_EQ(vt_timer_toc("alpha"), vtOK);
+
+        report = vt::timers_to_string();
+    });
+    std::cout << report;
+
+    // gamma is re-entered although it is not a child of the re-entered alpha
+    EXPECT_EQ(count_occurrences(report, "alpha"), 1u);
+    EXPECT_EQ(count_occurrences(report, "gamma"), 1u);
+    EXPECT_EQ(count_occurrences(report, "max depth 2"), 2u);
+    EXPECT_EQ(report.find("self -"), std::string::npos);
+#ifdef VT_TIMERS_VIRTUAL_CLOCK
+    EXPECT_EQ(count_occurrences(report, "self 2,"), 2u);
+#endif
+
+    vt_timers_reset();
+    vt_timers_set_recursion_mode(vtRECURSION_NESTED);
+}
+
+TEST(TimersTest, NestedRecursion)
+{
+    std::string report;
+    ASSERT_NO_THROW(
+    {
+        vt_timer_tic("solve");
+            recurse(5);
+        vt_timer_toc("solve");
+
+        report = vt::timers_to_string();
+    });
+    std::cout << report;
+
+    // without collapsing, every recursion level gets its own timer
+    EXPECT_EQ(count_occurrences(report, "recurse"), 5u);
+    EXPECT_EQ(count_occurrences(report, "max depth"), 0u);
+
+    vt_timers_reset();
+}
+
+static void VT_C_CALLCONV collect_outlier(const vtTimerOutlier* outlier, void* user_data)
+{
+    static_cast<std::vector<vtTimerOutlier>*>(user_data)->push_back(*outlier);
+}
+
+TEST(TimersTest, BudgetOutliers)
+{
+    std::vector<vtTimerOutlier> outliers;
+    size_t nr_dropped = 1;
+    ASSERT_NO_THROW(
+    {
+        EXPECT_EQ(vt_timer_set_budget("request", 0.005), vtOK);
+        EXPECT_EQ(vt_timer_set_budget("request", -1.0), vtERROR);
+
+        vt_timer_tic("server");
+            for (int i = 0; i < 5; ++i)
+            {
+                vt_timer_tic("request");
+                    sleep(i == 3 ? 10.0 : 1.0);
+                vt_timer_toc("request");
+            }
+        vt_timer_toc("server");
+
+        EXPECT_EQ(vt_timer_outliers_drain(collect_outlier, &outliers, &nr_dropped), vtOK);
+    });
+
+    ASSERT_EQ(outliers.size(), 1u);
+    EXPECT_STREQ(outliers[0].path, "server/request");
+    EXPECT_GE(outliers[0].duration, 0.010);
+    EXPECT_DOUBLE_EQ(outliers[0].budget, 0.005);
+    EXPECT_EQ(nr_dropped, 0u);
+    EXPECT_TRUE(vt::drain_timer_outliers().empty());
+
+    vt_timers_reset();
+}
+
+TEST(TimersTest, BudgetSetAfterTimerExists)
+{
+    std::vector<vtTimerOutlier> outliers;
+    ASSERT_NO_THROW(
+    {
+        vt_timer_tic("poll");
+            sleep(10.0);
+        vt_timer_toc("poll");
+
+        EXPECT_EQ(vt_timer_set_budget("poll", 0.005), vtOK);
+
+        vt_timer_tic("poll");
+            sleep(10.0);
+        vt_timer_toc("poll");
+
+        EXPECT_EQ(vt_timer_outliers_drain(collect_outlier, &outliers, nullptr), vtOK);
+    });
+
+    ASSERT_EQ(outliers.size(), 1u);
+    EXPECT_STREQ(outliers[0].path, "poll");
+
+    vt_timers_reset();
+}
+
+TEST(TimersTest, WorkCounters)
+{
+    std::string report;
+    ASSERT_NO_THROW(
+    {
+        EXPECT_EQ(vt_timer_count("items", 1.0), vtERROR);
+
+        vt_timer_tic("assemble");
+            for (int i = 0; i < 4; ++i)
+            {
+                vt_timer_tic("element");
+                    sleep(1.0);
+                    EXPECT_EQ(vt_timer_count("items", 250.0), vtOK);
+                    EXPECT_EQ(vt_timer_count("bytes", 1e6), vtOK);
+                vt_timer_toc("element");
+            }
+        vt_timer_toc("assemble");
+
+        report = vt::timers_to_string();
+    });
+    std::cout << report;
+
+    auto line_with = [&report](const std::string& word)
+    {
+        size_t begin = report.rfind('\n', report.find(word)) + 1;
+        return report.substr(begin, report.find('\n', begin) - begin);
+    };
+    EXPECT_NE(line_with("[items]").find(" 1000 "), std::string::npos);
+    EXPECT_NE(line_with("[bytes]").find(" 4e+06 "), std::string::npos);
+    EXPECT_NE(report.find(" items/s, "), std::string::npos);
+    EXPECT_NE(report.find(" ns/items"), std::string::npos);
+    EXPECT_NE(report.find(" GB/s, "), std::string::npos);
+
+    vt_timers_reset();
+}
+
+TEST(TimersTest, InternedLabels)
+{
+    std::string label("a dynamically built label");
+    const char* interned = vt::intern_label(label.c_str());
+
+    EXPECT_EQ(interned, vt::intern_label("a dynamically built label"));
+    EXPECT_NE(interned, label.c_str());
+    EXPECT_STREQ(interned, label.c_str());
+}
+
+TEST(TimersTest, NodeBudget)
+{
+    std::string report;
+    ASSERT_NO_THROW(
+    {
+        EXPECT_EQ(vt_timers_set_node_budget(5), vtOK);
+
+        vt_timer_tic("phase");
+            for (int i = 0; i < 100; ++i)
+            {
+                std::stringstream ss;
+                ss << "file " << i;
+                EXPECT_EQ(vt_timer_tic(ss.str().c_str()), vtOK);
+                    EXPECT_EQ(vt_timer_tic("read"), vtOK);
+                    EXPECT_EQ(vt_timer_toc("read"), vtOK);
+                EXPECT_EQ(vt_timer_toc(ss.str().c_str()), vtOK);
+            }
+        vt_timer_toc("phase");
+
+        report = vt::timers_to_string();
+    });
+    std::cout << report;
+
+    // phase, file 0, read, file 1 and read fit in the budget; the tics of the
+    // other files and their reads go to a single overflow timer
+    EXPECT_EQ(count_occurrences(report, "file "), 2u);
+    EXPECT_EQ(count_occurrences(report, "(overflow)"), 1u);
+    EXPECT_NE(report.find("(196)"), std::string::npos);
+    EXPECT_EQ(report.find("max depth"), std::string::npos);
+    EXPECT_NE(report.find("folded ~"), std::string::npos);
+
+    vt_timers_reset();
+    vt_timers_set_node_budget(0);
+}
+
+TEST(TimersTest, Epochs)
+{
+    size_t first = 0, second = 0;
+    std::string first_report, second_report, report;
+    ASSERT_NO_THROW(
+    {
+        vt_timer_tic("phase one");
+            sleep(5.0);
+        vt_timer_toc("phase one");
+        vt_timer_tic("spanning");
+            sleep(5.0);
+            EXPECT_EQ(vt_timers_advance_epoch(&first), vtOK);
+            sleep(5.0);
+        vt_timer_toc("spanning");
+        vt_timer_tic("phase two");
+            sleep(5.0);
+        vt_timer_toc("phase two");
+        EXPECT_EQ(vt_timers_advance_epoch(&second), vtOK);
+
+        first_report = vt::timers_epoch_to_string(first);
+        second_report = vt::timers_epoch_to_string(second);
+        report = vt::timers_to_string();
+    });
+    std::cout << first_report << second_report;
+
+    EXPECT_EQ(second, first + 1);
+
+    EXPECT_NE(first_report.find("phase one"), std::string::npos);
+    EXPECT_NE(first_report.find("spanning"), std::string::npos);
+    EXPECT_EQ(first_report.find("phase two"), std::string::npos);
+
+    // the running timer was split; its call is counted in the first epoch
+    EXPECT_EQ(second_report.find("phase one"), std::string::npos);
+    size_t spanning = second_report.find("spanning");
+    ASSERT_NE(spanning, std::string::npos);
+    EXPECT_EQ(second_report.find("(0)", spanning), second_report.find("(", spanning));
+    EXPECT_NE(second_report.find("phase two"), std::string::npos);
+
+    // the totals are not affected
+    EXPECT_EQ(count_occurrences(report, "(1)"), 4u);
+
+    EXPECT_NE(vt::timers_epoch_to_string(second + 100).find("No timings to report"), std::string::npos);
+
+    vt_timers_reset();
+}
+
+
+static void VT_C_CALLCONV count_node(const vtTimerNode*, void* user_data)
+{
+    ++*static_cast<size_t*>(user_data);
+}
+
+
+TEST(TimersTest, Queries)
+{
+    ASSERT_NO_THROW(
+    {
+        vt_timer_tic("solve");
+            for (int i = 0; i < 2; ++i)
+            {
+                vt_timer_tic("assemble");
+                    sleep(10.0);
+                vt_timer_toc("assemble");
+            }
+            vt_timer_tic("compute");
+                sleep(20.0);
+            vt_timer_toc("compute");
+        vt_timer_toc("solve");
+    });
+
+    size_t nr_visited = 0;
+    EXPECT_EQ(vt_timers_visit(count_node, &nr_visited), vtOK);
+    EXPECT_EQ(nr_visited, 4u);  // thread, solve, assemble and compute
+
+    vtTimerNode nodes[3];
+    size_t nr_nodes = 0;
+    EXPECT_EQ(vt_timers_get_nodes(nodes, 3, &nr_nodes), vtWARNING);
+    EXPECT_EQ(nr_nodes, 4u);
+    EXPECT_STREQ(nodes[0].label, "Main thread");
+    EXPECT_EQ(nodes[0].depth, 0u);
+    EXPECT_EQ(nodes[0].parent, SIZE_MAX);
+    EXPECT_STREQ(nodes[1].label, "solve");
+    EXPECT_EQ(nodes[1].parent, 0u);
+    EXPECT_STREQ(nodes[2].label, "assemble");
+    EXPECT_STREQ(nodes[2].thread, "Main thread");
+    EXPECT_EQ(nodes[2].parent, 1u);
+    EXPECT_EQ(nodes[2].depth, 2u);
+    EXPECT_EQ(nodes[2].nr_calls, 2u);
+
+    vtTimerNode node;
+    EXPECT_EQ(vt_timers_find("Main thread", "solve/compute", &node), vtOK);
+    EXPECT_EQ(node.index, 3u);
+    EXPECT_EQ(node.nr_calls, 1u);
+#ifdef VT_TIMERS_VIRTUAL_CLOCK
+    EXPECT_DOUBLE_EQ(node.wall_time, 0.02);
+#endif
+    EXPECT_EQ(vt_timers_find(nullptr, "solve/missing", &node), vtWARNING);
+    EXPECT_EQ(vt_timers_find(nullptr, "compute", &node), vtWARNING);
+    EXPECT_EQ(vt_timers_find("thread id 0", "solve", &node), vtWARNING);
+
+    EXPECT_EQ(vt::timer_nodes().size(), 4u);
+
+    vt_timers_reset();
+}
+
+
 static void thread(const int i)
 {
     std::stringstream ss;
@@ -285,6 +696,293 @@ TEST(ThreadedTimersTest, CorrectUsageManualThreads)
     vt_timers_reset();
 }
 
+TEST(ThreadedTimersTest, CountersMergedAcrossThreads)
+{
+    auto count_work = [](const bool with_counters)
+    {
+        std::vector<std::thread> threads(4);
+        for (auto& worker : threads)
+        {
+            worker = std::thread([with_counters]()
+            {
+                vt_timer_tic("work");
+                    sleep(10.0);
+                    if (with_counters)
+                        vt_timer_count("items", 100.0);
+                vt_timer_toc("work");
+            });
+        }
+        for (auto& worker : threads)
+            worker.join();
+        return vt::timers_to_string();
+    };
+
+    std::string report;
+    ASSERT_NO_THROW(
+    {
+        // the merged tree is only reported when there are counters to merge
+        report = count_work(false);
+        EXPECT_EQ(report.find("All threads"), std::string::npos);
+        vt_timers_reset();
+
+        report = count_work(true);
+    });
+    std::cout << report;
+
+    size_t all_threads = report.find("All threads");
+    ASSERT_NE(all_threads, std::string::npos);
+    std::string merged = report.substr(all_threads);
+    size_t items = merged.find("[items]");
+    ASSERT_NE(items, std::string::npos);
+    std::string items_line = merged.substr(items, merged.find('\n', items) - items);
+    EXPECT_NE(items_line.find(" 400 "), std::string::npos);
+    EXPECT_NE(items_line.find(" items/s per thread"), std::string::npos);
+
+    // the rates of the individual threads are not labelled
+    EXPECT_EQ(report.substr(0, all_threads).find("per thread"), std::string::npos);
+
+    vt_timers_reset();
+}
+
+
+TEST(ThreadedTimersTest, RecursionModeChangedWhileTiming)
+{
+    std::atomic<int> step(0);
+    auto wait_for_step = [&step](const int n)
+    {
+        while (step.load() < n)
+            std::this_thread::yield();
+    };
+
+    ASSERT_NO_THROW(
+    {
+        std::thread worker([&step, &wait_for_step]()
+        {
+            EXPECT_EQ(vt_timer_tic("outer"), vtOK);
+                step.store(1);
+                wait_for_step(2);
+                // still nested: the mode changed while this thread was timing
+                EXPECT_EQ(vt_timer_tic("outer"), vtOK);
+                EXPECT_EQ(vt_timer_toc("outer"), vtOK);
+            EXPECT_EQ(vt_timer_toc("outer"), vtOK);
+
+            // collapsed from here on
+            recurse(3);
+            EXPECT_EQ(vt_timer_tic("again"), vtOK);
+                EXPECT_EQ(vt_timer_tic("inner"), vtOK);
+                    EXPECT_EQ(vt_timer_tic("again"), vtOK);
+                        step.store(3);
+                        wait_for_step(4);
+                    EXPECT_EQ(vt_timer_toc("again"), vtOK);
+                EXPECT_EQ(vt_timer_toc("inner"), vtOK);
+            EXPECT_EQ(vt_timer_toc("again"), vtOK);
+
+            // nested again
+            EXPECT_EQ(vt_timer_tic("again"), vtOK);
+                EXPECT_EQ(vt_timer_tic("again"), vtOK);
+                EXPECT_EQ(vt_timer_toc("again"), vtOK);
+            EXPECT_EQ(vt_timer_toc("again"), vtOK);
+        });
+
+        wait_for_step(1);
+        EXPECT_EQ(vt_timers_set_recursion_mode(vtRECURSION_COLLAPSED), vtOK);
+        step.store(2);
+        wait_for_step(3);
+        EXPECT_EQ(vt_timers_set_recursion_mode(vtRECURSION_NESTED), vtOK);
+        step.store(4);
+        worker.join();
+    });
+
+    vtTimerNode node;
+    EXPECT_TRUE(vt::find_timer(nullptr, "outer/outer", node));
+    ASSERT_TRUE(vt::find_timer(nullptr, "recurse", node));
+    EXPECT_EQ(node.nr_calls, 3u);
+    EXPECT_FALSE(vt::find_timer(nullptr, "recurse/recurse", node));
+    ASSERT_TRUE(vt::find_timer(nullptr, "again", node));
+    EXPECT_EQ(node.nr_calls, 3u);
+    ASSERT_TRUE(vt::find_timer(nullptr, "again/again", node));
+    EXPECT_EQ(node.nr_calls, 1u);
+
+    vt_timers_reset();
+    vt_timers_set_recursion_mode(vtRECURSION_NESTED);
+}
+
+
+TEST(ThreadedTimersTest, ShortLivedThreads)
+{
+    std::vector<std::thread::id> ids;
+    ASSERT_NO_THROW(
+    {
+        // thread ids of joined threads are typically reused
+        for (int i = 0; i < 50; ++i)
+        {
+            std::thread worker([]()
+            {
+                vt_timer_tic("short work");
+                vt_timer_toc("short work");
+            });
+            ids.push_back(worker.get_id());
+            worker.join();
+        }
+    });
+    std::sort(ids.begin(), ids.end());
+    const size_t nr_distinct_ids = static_cast<size_t>(std::unique(ids.begin(), ids.end()) - ids.begin());
+
+    // one tree per distinct thread id, holding the calls of all threads with that id
+    const std::vector<vtTimerNode> nodes = vt::timer_nodes();
+    size_t nr_roots = 0;
+    for (const auto& node : nodes)
+        if (node.depth == 0)
+            ++nr_roots;
+    EXPECT_EQ(nr_roots, nr_distinct_ids);
+    EXPECT_EQ(nodes.size(), 2 * nr_distinct_ids);
+
+    vtTimerNode work;
+    ASSERT_TRUE(vt::find_timer(nullptr, "short work", work));
+    EXPECT_EQ(work.nr_calls, 50u);
+
+    vt_timers_reset();
+}
+
+
+TEST(ThreadedTimersTest, ThreadRoles)
+{
+    std::string report;
+    ASSERT_NO_THROW(
+    {
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 20; ++i)
+        {
+            threads.emplace_back([i]()
+            {
+                vt_timer_set_thread_role(i % 2 == 0 ? "io-worker" : "compute-worker");
+                vt_timer_tic("task");
+                    sleep(1.0);
+                vt_timer_toc("task");
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+
+        report = vt::timers_to_string();
+    });
+    std::cout << report;
+
+    EXPECT_NE(report.find("Collected timer info from 2 threads"), std::string::npos);
+    EXPECT_EQ(count_occurrences(report, "io-worker"), 1u);
+    EXPECT_EQ(count_occurrences(report, "compute-worker"), 1u);
+    EXPECT_EQ(count_occurrences(report, "(10)"), 4u);  // task and role per role
+    EXPECT_EQ(report.find("All threads"), std::string::npos);  // no counters to merge
+
+    vt_timers_reset();
+}
+
+
+TEST(ThreadedTimersTest, EpochsWhileTiming)
+{
+    size_t first = 0, second = 0;
+    std::string first_report, second_report;
+    ASSERT_NO_THROW(
+    {
+        std::atomic<bool> stop(false);
+        std::atomic<int> nr_steps(0);
+        std::thread worker([&stop, &nr_steps]()
+        {
+            while (!stop.load())
+            {
+                vt_timer_tic("step");
+                    sleep(1.0);
+                vt_timer_toc("step");
+                ++nr_steps;
+            }
+        });
+        auto wait_for_steps = [&nr_steps](const int n)
+        {
+            while (nr_steps.load() < n)
+                std::this_thread::yield();
+        };
+
+        // the worker is not stopped or blocked by advancing the epoch
+        wait_for_steps(10);
+        EXPECT_EQ(vt_timers_advance_epoch(&first), vtOK);
+        wait_for_steps(nr_steps.load() + 10);
+        EXPECT_EQ(vt_timers_advance_epoch(&second), vtOK);
+        stop.store(true);
+        worker.join();
+
+        first_report = vt::timers_epoch_to_string(first);
+        second_report = vt::timers_epoch_to_string(second);
+    });
+    std::cout << first_report << second_report;
+
+    EXPECT_NE(first_report.find("from 1 thread"), std::string::npos);
+    EXPECT_NE(first_report.find("step"), std::string::npos);
+    EXPECT_NE(second_report.find("from 1 thread"), std::string::npos);
+    EXPECT_NE(second_report.find("step"), std::string::npos);
+
+    vt_timers_reset();
+}
+
+
+TEST(ThreadedTimersTest, QueryAllThreads)
+{
+    ASSERT_NO_THROW(
+    {
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 3; ++i)
+        {
+            threads.emplace_back([]()
+            {
+                vt_timer_tic("task");
+                    sleep(5.0);
+                vt_timer_toc("task");
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+    });
+
+    vtTimerNode node;
+    EXPECT_TRUE(vt::find_timer(nullptr, "task", node));
+    EXPECT_EQ(node.nr_calls, 3u);
+    EXPECT_EQ(node.depth, 1u);
+#ifdef VT_TIMERS_VIRTUAL_CLOCK
+    EXPECT_DOUBLE_EQ(node.wall_time, 0.015);
+#endif
+
+    vt_timers_reset();
+}
+
+
+TEST(ThreadedTimersTest, QueryFromOtherThread)
+{
+    std::string report;
+    ASSERT_NO_THROW(
+    {
+        vt_timer_tic("A");
+        vt_timer_toc("A");
+        vt_timers_advance_epoch(nullptr);
+
+        std::thread monitor([]()
+        {
+            vt::timer_nodes();
+        });
+        monitor.join();
+
+        vt_timer_tic("A");
+        vt_timer_toc("A");
+        report = vt::timers_to_string();
+    });
+    std::cout << report;
+
+    // the main thread is named by the thread that reports, not by the one that merged
+    EXPECT_NE(report.find("Collected timer info from 1 thread\n"), std::string::npos);
+    EXPECT_EQ(count_occurrences(report, "Main thread"), 1u);
+    EXPECT_NE(report.find("(2)", report.find("\n   A ")), std::string::npos);
+
+    vt_timers_reset();
+}
+
 
 TEST(ThreadedTimersTest, CorrectUsageOpenMP)
 {
@@ -320,6 +1018,343 @@ TEST(ThreadedTimersTest, CorrectUsageOpenMP)
 }
 
 
+#ifdef VT_TIMERS_OMPT
+// LLVM's OpenMP runtime (libomp) starts OMPT tools; GCC's libgomp does not.
+static bool openmp_runtime_is_libomp()
+{
+    return dlsym(RTLD_DEFAULT, "__kmpc_global_thread_num") != nullptr;
+}
+
+
+static void imbalanced_parallel_region()
+{
+    #pragma omp parallel
+    {
+        sleep(omp_get_thread_num() * 5.0);
+        #pragma omp barrier
+    }
+}
+
+TEST(ThreadedTimersTest, OMPTRegions)
+{
+    if (!openmp_runtime_is_libomp())
+        GTEST_SKIP() << "The OpenMP runtime is not libomp, so it does not start OMPT tools";
+    const char* omp_tool = std::getenv("OMP_TOOL");
+    if (omp_tool != nullptr && std::string(omp_tool) == "disabled")
+        GTEST_SKIP() << "OMPT tools are disabled with OMP_TOOL=disabled";
+
+    std::string report;
+    ASSERT_NO_THROW(
+    {
+        vt_timer_tic("top level");
+            imbalanced_parallel_region();
+        vt_timer_toc("top level");
+
+        report = vt::timers_to_string();
+    });
+    std::cout << report;
+
+    // the parallel region is timed under the tic of the main thread
+    size_t top_level = report.find("top level");
+    ASSERT_NE(top_level, std::string::npos);
+    EXPECT_NE(report.find("omp parallel", top_level), std::string::npos);
+    EXPECT_NE(report.find("barrier", top_level), std::string::npos);
+
+    vt_timers_reset();
+}
+#endif
+
+
+#ifdef VT_TIMERS_VIRTUAL_CLOCK
+// Returns the time in ms reported after the first occurrence of label after from.
+static double milliseconds_of(const std::string& report, const std::string& label, const size_t from = 0)
+{
+    size_t position = report.find(label + "  ", from);
+    if (position == std::string::npos)
+        return -1.0;
+    std::istringstream line(report.substr(position + label.size()));
+    double milliseconds = -1.0;
+    line >> milliseconds;
+    return milliseconds;
+}
+
+
+TEST(VirtualClockTest, ExactTotals)
+{
+    std::string report;
+    ASSERT_NO_THROW(
+    {
+        vt_timer_tic("solve");
+            sleep(100.0);
+            for (int i = 0; i < 3; ++i)
+            {
+                vt_timer_tic("assemble");
+                    sleep(50.0);
+                vt_timer_toc("assemble");
+            }
+        vt_timer_toc("solve");
+        report = vt::timers_to_string();
+    });
+    std::cout << report;
+
+    EXPECT_EQ(milliseconds_of(report, "Main thread"), 250.0);
+    EXPECT_EQ(milliseconds_of(report, "solve"), 250.0);
+    EXPECT_EQ(milliseconds_of(report, "assemble"), 150.0);
+    EXPECT_EQ(milliseconds_of(report, "(other)"), 100.0);
+    EXPECT_NE(report.find("(3)", report.find("assemble")), std::string::npos);
+
+    vt_timers_reset();
+}
+
+
+TEST(VirtualClockTest, OtherThreshold)
+{
+    std::string report;
+    ASSERT_NO_THROW(
+    {
+        vt_timer_tic("hidden");  // 0.5% of the time in (other)
+            sleep(0.5);
+            vt_timer_tic("child");
+                sleep(99.5);
+            vt_timer_toc("child");
+        vt_timer_toc("hidden");
+        vt_timer_tic("shown");  // 2% of the time in (other)
+            sleep(2.0);
+            vt_timer_tic("child");
+                sleep(98.0);
+            vt_timer_toc("child");
+        vt_timer_toc("shown");
+        report = vt::timers_to_string();
+    });
+    std::cout << report;
+
+    size_t hidden = report.find("hidden");
+    size_t shown = report.find("shown");
+    ASSERT_NE(hidden, std::string::npos);
+    ASSERT_NE(shown, std::string::npos);
+    EXPECT_EQ(count_occurrences(report, "(other)"), 1u);
+    EXPECT_EQ(milliseconds_of(report, "(other)", shown), 2.0);
+
+    vt_timers_reset();
+}
+
+
+TEST(VirtualClockTest, EpochSplitAtItsStart)
+{
+    size_t ended = 0;
+    std::string ended_report, next_report;
+    ASSERT_NO_THROW(
+    {
+        std::atomic<int> step(0);
+        auto wait_for_step = [&step](const int n)
+        {
+            while (step.load() < n)
+                std::this_thread::yield();
+        };
+
+        // new threads start at the same virtual time
+        std::thread worker([&step, &wait_for_step]()
+        {
+            vt_timer_tic("work");
+                sleep(10.0);
+                step.store(1);
+                wait_for_step(2);
+                sleep(30.0);
+            vt_timer_toc("work");
+        });
+        std::thread advancer([&step, &wait_for_step, &ended]()
+        {
+            wait_for_step(1);
+            sleep(10.0);
+            vt_timers_advance_epoch(&ended);
+            step.store(2);
+        });
+        advancer.join();
+        worker.join();
+
+        ended_report = vt::timers_epoch_to_string(ended);
+        next_report = vt::timers_epoch_to_string(ended + 1);
+    });
+    std::cout << ended_report << next_report;
+
+    // the worker notices the new epoch only at its toc
+    EXPECT_EQ(milliseconds_of(ended_report, "work"), 10.0);
+    EXPECT_EQ(milliseconds_of(next_report, "work"), 30.0);
+
+    vt_timers_reset();
+}
+
+
+TEST(VirtualClockTest, BudgetOfCallAcrossEpochs)
+{
+    size_t ended = 0;
+    std::vector<vtTimerOutlier> outliers;
+    std::string ended_report, next_report;
+    ASSERT_NO_THROW(
+    {
+        EXPECT_EQ(vt_timer_set_budget("step", 0.005), vtOK);
+
+        vt_timer_tic("step");
+            sleep(4.0);
+            vt_timers_advance_epoch(&ended);
+            sleep(4.0);
+        vt_timer_toc("step");
+
+        EXPECT_EQ(vt_timer_outliers_drain(collect_outlier, &outliers, nullptr), vtOK);
+        vt_timers_advance_epoch(nullptr);
+        ended_report = vt::timers_epoch_to_string(ended);
+        next_report = vt::timers_epoch_to_string(ended + 1);
+    });
+    std::cout << ended_report << next_report;
+
+    // the budget applies to the whole call, the epochs get their own part of it
+    ASSERT_EQ(outliers.size(), 1u);
+    EXPECT_DOUBLE_EQ(outliers[0].duration, 0.008);
+    EXPECT_EQ(milliseconds_of(ended_report, "step"), 4.0);
+    EXPECT_EQ(milliseconds_of(next_report, "step"), 4.0);
+
+    vt_timers_reset();
+}
+
+
+TEST(VirtualClockTest, ThreadMerge)
+{
+    std::string report;
+    ASSERT_NO_THROW(
+    {
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 4; ++i)
+        {
+            threads.emplace_back([i]()
+            {
+                vt_timer_set_thread_role("worker");
+                vt_timer_tic("task");
+                    sleep(10.0 * (i + 1));
+                vt_timer_toc("task");
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+
+        report = vt::timers_to_string();
+    });
+    std::cout << report;
+
+    size_t worker = report.find("worker");
+    ASSERT_NE(worker, std::string::npos);
+    EXPECT_EQ(milliseconds_of(report, "task", worker), 100.0);
+    EXPECT_NE(report.find("(4)", worker), std::string::npos);
+
+    vt_timers_reset();
+}
+#endif
+
+
+#ifdef VT_TIMERS_SAMPLER
+// Busy-waits on the real clock, also when the timers use the virtual clock, so
+// that the thread uses CPU time to be sampled.
+static void burn_cpu(const double milliseconds)
+{
+    using namespace std::chrono;
+    auto t0 = steady_clock::now();
+    while (duration<double, std::milli>(steady_clock::now() - t0).count() < milliseconds)
+        ;
+}
+
+
+TEST(SamplerTest, SamplesOfRunningTimers)
+{
+    std::string report;
+    vtTimerNode hot, cold;
+    ASSERT_NO_THROW(
+    {
+        EXPECT_EQ(vt_sampler_start(0.0, 0), vtERROR);
+        EXPECT_EQ(vt_sampler_start(1000.0, 9), vtERROR);
+        EXPECT_EQ(vt_sampler_start(1000.0, 4), vtOK);
+        vt_timer_tic("hot");
+            burn_cpu(200.0);
+        vt_timer_toc("hot");
+        vt_timer_tic("cold");
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        vt_timer_toc("cold");
+        EXPECT_EQ(vt_sampler_stop(), vtOK);
+
+        report = vt::timers_to_string();
+        EXPECT_TRUE(vt::find_timer("Main thread", "hot", hot));
+        EXPECT_TRUE(vt::find_timer("Main thread", "cold", cold));
+    });
+    std::cout << report;
+
+    // about 50 samples in hot (at 250 ticks per second), and none while sleeping
+    EXPECT_GT(hot.nr_samples, 20u);
+    EXPECT_LT(cold.nr_samples, 5u);
+    EXPECT_NE(report.find("[sampled self]"), std::string::npos);
+    EXPECT_NE(report.find("[sampled]"), std::string::npos);
+
+    vt_timers_reset();
+}
+
+
+TEST(SamplerTest, NewThreads)
+{
+    vtTimerNode work;
+    ASSERT_NO_THROW(
+    {
+        EXPECT_EQ(vt_sampler_start(1000.0, 0), vtOK);
+        std::thread worker([]()
+        {
+            vt_timer_tic("work");
+                burn_cpu(200.0);
+            vt_timer_toc("work");
+        });
+        worker.join();
+        EXPECT_EQ(vt_sampler_stop(), vtOK);
+
+        EXPECT_TRUE(vt::find_timer(nullptr, "work", work));
+    });
+
+    EXPECT_GT(work.nr_samples, 10u);
+
+    vt_timers_reset();
+}
+
+
+TEST(SamplerTest, ThreadsAlreadyTiming)
+{
+    vtTimerNode work;
+    ASSERT_NO_THROW(
+    {
+        std::atomic<int> step(0);
+        std::thread worker([&step]()
+        {
+            vt_timer_tic("job");
+                step.store(1);
+                while (step.load() < 2)
+                    std::this_thread::yield();
+                vt_timer_tic("work");
+                    burn_cpu(200.0);
+                vt_timer_toc("work");
+            vt_timer_toc("job");
+        });
+
+        // the worker started timing before the sampler
+        while (step.load() < 1)
+            std::this_thread::yield();
+        EXPECT_EQ(vt_sampler_start(1000.0, 0), vtOK);
+        step.store(2);
+        worker.join();
+        EXPECT_EQ(vt_sampler_stop(), vtOK);
+
+        EXPECT_TRUE(vt::find_timer(nullptr, "job/work", work));
+    });
+
+    EXPECT_GT(work.nr_samples, 10u);
+
+    vt_timers_reset();
+}
+#endif
+
+
 TEST(C_API, cstream)
 {
     ASSERT_NO_THROW(